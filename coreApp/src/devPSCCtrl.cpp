@@ -88,6 +88,25 @@ long init_count(longinRecord* prec)
     return 0;
 }
 
+long init_seq_count(longinRecord* prec)
+{
+    assert(prec->inp.type==INST_IO);
+    try {
+        std::istringstream strm(prec->inp.value.instio.string);
+        std::string pscname;
+        unsigned long blocknum;
+        strm >> pscname >> blocknum;
+        if(strm.fail() || blocknum>0xffff)
+            throw std::runtime_error("Failed to parse INP");
+        PSCBase *psc = PSCBase::getPSCBase(pscname);
+        if(!psc)
+            throw std::runtime_error("Can't find PSC");
+        Guard g(psc->lock);
+        prec->dpvt = (void*)psc->getRecv(blocknum);
+    }CATCH(init_seq_count, prec)
+    return 0;
+}
+
 long get_iointr_info(int cmd, dbCommon *prec, IOSCANPVT *io)
 {
     if(!prec->dpvt)
@@ -178,6 +197,20 @@ long read_block_count(longinRecord* prec)
     return 0;
 }
 
+template<epicsUInt32 Block::*CNT>
+long read_seq_count(longinRecord* prec)
+{
+    if(!prec->dpvt)
+        return -1;
+    Block *block=(Block*)prec->dpvt;
+    try {
+        Guard g(block->psc.lock);
+        prec->val = block->*CNT;
+    }CATCH(read_seq_count, prec)
+
+    return 0;
+}
+
 long write_force_reconnect(boRecord* prec)
 {
     if(!prec->dpvt)
@@ -235,6 +268,9 @@ MAKEDSET(longout, devPSCSendLo, &init_output<longoutRecord>, NULL, &write_lo_sen
 MAKEDSET(longin, devPSCUknCountLi, &init_input<longinRecord>, &get_iointr_info, &read_unknown_count);
 MAKEDSET(longin, devPSCConnCountLi, &init_input<longinRecord>, &get_iointr_info, &read_connection_count);
 MAKEDSET(longin, devPSCBlockCountLi, &init_count, NULL, &read_block_count);
+MAKEDSET(longin, devPSCSeqLostLi, &init_seq_count, NULL, &read_seq_count<&Block::seqLost>);
+MAKEDSET(longin, devPSCSeqDupLi, &init_seq_count, NULL, &read_seq_count<&Block::seqDup>);
+MAKEDSET(longin, devPSCSeqReorderLi, &init_seq_count, NULL, &read_seq_count<&Block::seqReorder>);
 
 } // namespace
 
@@ -249,3 +285,6 @@ epicsExportAddress(dset, devPSCSendLo);
 epicsExportAddress(dset, devPSCUknCountLi);
 epicsExportAddress(dset, devPSCConnCountLi);
 epicsExportAddress(dset, devPSCBlockCountLi);
+epicsExportAddress(dset, devPSCSeqLostLi);
+epicsExportAddress(dset, devPSCSeqDupLi);
+epicsExportAddress(dset, devPSCSeqReorderLi);
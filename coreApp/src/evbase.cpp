@@ -19,6 +19,7 @@
 
 #define epicsExportSharedSymbols
 #include "psc/evbase.h"
+#include "psc/thread.h"
 
 std::tr1::weak_ptr<EventBase> EventBase::last_base;
 
@@ -48,6 +49,7 @@ EventBase::~EventBase()
 
 void EventBase::run()
 {
+    pscThreadApply("eventbase", 0);
     epicsGuard<epicsMutex> g(lock);
     assert(base);
     timeval tv={10000,0};
@@ -167,6 +169,21 @@ void dbuffer::assign(const void *buf, size_t len)
     strides.swap(S);
 }
 
+void dbuffer::adopt(std::vector<char>& buf)
+{
+    if(backingb) {
+        evbuffer_free(backingb);
+        backingb = 0;
+        backingv.clear();
+    }
+    backingv.swap(buf);
+
+    // usually already has one element, so no allocation
+    strides.resize(1u);
+    strides[0].iov_base = backingv.empty() ? 0 : &backingv[0];
+    strides[0].iov_len = backingv.size();
+}
+
 void dbuffer::consume(evbuffer *buf, size_t len)
 {
     const size_t total = evbuffer_get_length(buf);
@@ -31,6 +31,7 @@
 #include <event2/buffer.h>
 
 #include "cblist.h"
+#include "seqcheck.h"
 
 #if __cplusplus<201103L
 #  ifndef override
@@ -103,6 +104,11 @@ struct PSC_API Block
     epicsUInt32 scanCount;
     epicsUInt32 scanOflow;
 
+    // RX sequence counter checking.  See setPSCRecvSequence()
+    epicsUInt32 seqLost;    // missing counter values
+    epicsUInt32 seqDup;     // duplicated counter values
+    epicsUInt32 seqReorder; // arrived out of order
+
     epicsTime rxtime; // RX timestamp
 
     Block(PSCBase*, epicsUInt16);
@@ -153,6 +159,16 @@ public:
     virtual void flushSend()=0;
     virtual void forceReConnect()=0;
 
+    // Enable checking of a sequence counter at 'offset' in the body of
+    // received blocks with this ID.  With non-zero 'window', also reorder.
+    // throws std::runtime_error if not supported.
+    virtual void setRecvSequence(epicsUInt16 block, epicsUInt32 offset, epicsUInt32 window);
+
+    // Receive from IPv4 multicast 'group' on the local interface with address 'iface' (empty for any),
+    // only from the device address.
+    // throws std::runtime_error if not supported, or on failure.
+    virtual void joinMulticast(const std::string& group, const std::string& iface);
+
     inline bool isConnected() const{return connected;}
     inline std::string lastMessage() const{return message;}
 
@@ -288,6 +304,10 @@ public:
     virtual void flushSend() override;
     virtual void forceReConnect() override;
 
+    virtual void setRecvSequence(epicsUInt16 block, epicsUInt32 offset, epicsUInt32 window) override final;
+
+    virtual void joinMulticast(const std::string& group, const std::string& iface) override final;
+
 private:
     void queueHeader(Block* blk, epicsUInt16 id, epicsUInt32 buflen);
 
@@ -305,11 +325,18 @@ private:
               txbuf;   // ready to sendto()
     sendbuf_t readybuf;// a free list
 
+    // per block ID sequence checking.  Entries include header
+    typedef SeqWindow<buffer_t, Block> seqwindow_t;
+    typedef std::map<epicsUInt16, seqwindow_t> seqcheck_t;
+    seqcheck_t seqCheck;
+    std::vector<buffer_t> seqReady;
+
     virtual void connect() override;
     virtual void stopinloop() override final;
 
     void senddata(short evt);
     void recvdata(short evt);
+    void recvblock(epicsUInt16 id, const char *body, epicsUInt32 bodylen);
 
     static void ev_send(int,short,void*);
     static void ev_recv(int,short,void*);
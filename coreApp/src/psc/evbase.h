@@ -88,6 +88,9 @@ public:
     // resize and copy in
     void assign(const void *buf, size_t len);
 
+    // take contents of 'buf' without copying.  'buf' is left with the previous backing vector (maybe empty).
+    void adopt(std::vector<char>& buf);
+
     // move contents in.  Removes 'len' bytes from input evbuffer
     void consume(evbuffer *buf, size_t len=(size_t)-1);
 
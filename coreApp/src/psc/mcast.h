@@ -0,0 +1,32 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef PSC_MCAST_H
+#define PSC_MCAST_H
+
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sockaddr_in;
+
+/* Join IPv4 multicast 'group' (eg. "239.1.2.3") on the receive socket 'sock'.
+ * 'iface' is the address of the local interface to join on, or NULL or "" to let the OS choose.
+ * With non-NULL 'source', only datagrams from that source address are delivered (SSM).
+ * The source port is ignored.
+ * Returns 0 on success, or an errno value.
+ */
+PSC_API
+int pscJoinMulticast(int sock, const char *group, const char *iface, const struct sockaddr_in *source);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PSC_MCAST_H */
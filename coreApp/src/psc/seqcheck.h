@@ -0,0 +1,180 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef PSC_SEQCHECK_H
+#define PSC_SEQCHECK_H
+
+#include <deque>
+#include <vector>
+
+#include <epicsTypes.h>
+
+/* Check, and optionally restore, the order of received messages
+ * using a 32-bit big endian counter found in each message body.
+ * Gaps, duplicates, and reorders are counted in a Block.
+ * See setPSCRecvSequence()
+ *
+ * With a non-zero 'window', messages arriving early are held until the
+ * missing message(s) arrive, or until 'window' later messages are held.
+ * Messages arriving after being skipped over are discarded.
+ *
+ * PKT must be default constructible and have a swap() method.
+ * Caller must lock the PSCBase which owns the Block.
+ */
+template<typename PKT, typename BLOCK>
+class SeqWindow
+{
+public:
+    const epicsUInt32 offset; // byte offset in body of counter
+    const epicsUInt32 window; // max. # of early messages held.  0 to only count
+
+    SeqWindow(BLOCK* blk, epicsUInt32 offset, epicsUInt32 window)
+        :offset(offset)
+        ,window(window)
+        ,blk(blk)
+        ,started(false)
+        ,next(0u)
+        ,history(0u)
+        ,nheld(0u)
+    {}
+
+    // # of messages currently held
+    size_t holding() const { return nheld; }
+
+    // Process one message with counter value 'seq'.
+    // Messages ready for delivery are appended to 'ready', in sequence order.
+    // Returns false if 'pkt' is a duplicate, or too late, and should be discarded.
+    // Otherwise 'pkt' is moved to 'ready' or held.
+    bool push(epicsUInt32 seq, PKT& pkt, std::vector<PKT>& ready)
+    {
+        if(!started) {
+            started = true;
+            next = seq;
+        }
+        epicsInt32 dist = epicsInt32(seq - next);
+
+        if(dist<0) {
+            epicsUInt32 back = epicsUInt32(-(dist+1)); // 0 for next-1
+            if(back<64u) {
+                epicsUInt64 bit = epicsUInt64(1u)<<back;
+                if(history&bit) {
+                    blk->seqDup++;
+                    return false;
+                }
+                // arrives after being counted as lost
+                history |= bit;
+                blk->seqReorder++;
+                if(blk->seqLost)
+                    blk->seqLost--;
+                if(window)
+                    return false; // too late to deliver in order
+                deliver(pkt, ready);
+                return true;
+            }
+            // far behind.  Assume the sender has restarted its counter.
+            flush(ready);
+            next = seq;
+            history = 0u;
+            dist = 0;
+        }
+
+        if(epicsUInt32(dist) > window) {
+            // make room by giving up on the oldest missing
+            skip(seq - window, ready);
+            dist = epicsInt32(seq - next); // may now be in order
+        }
+
+        if(dist==0) {
+            if(nheld)
+                blk->seqReorder++; // fills a gap
+            deliver(pkt, ready);
+            advance(true);
+            release(ready);
+            return true;
+        }
+
+        size_t slot = size_t(dist-1);
+        if(held.size()<=slot) {
+            held.resize(slot+1u);
+            present.resize(slot+1u, false);
+        }
+        if(present[slot]) {
+            blk->seqDup++;
+            return false;
+        }
+        held[slot].swap(pkt);
+        present[slot] = true;
+        nheld++;
+        return true;
+    }
+
+    // Give up on any missing messages, and deliver all held.
+    // eg. when the sender goes quiet.
+    void flush(std::vector<PKT>& ready)
+    {
+        skip(next + epicsUInt32(held.size()), ready);
+    }
+
+private:
+    BLOCK *blk;
+    bool started;
+    epicsUInt32 next;    // next expected counter value
+    epicsUInt64 history; // bit N set if next-1-N was seen
+    std::deque<PKT> held; // held[N] has next+1+N if present[N].  back() is always present
+    std::deque<bool> present;
+    size_t nheld;
+
+    void deliver(PKT& pkt, std::vector<PKT>& ready)
+    {
+        ready.push_back(PKT());
+        ready.back().swap(pkt);
+    }
+
+    void advance(bool seen)
+    {
+        next++;
+        history = (history<<1u) | (seen ? 1u : 0u);
+    }
+
+    // after 'next' is advanced, held.front() is 'next'.
+    // deliver held messages which are now in order.
+    void release(std::vector<PKT>& ready)
+    {
+        while(!held.empty()) {
+            const bool have = present.front();
+            if(have) {
+                deliver(held.front(), ready);
+                nheld--;
+            }
+            held.pop_front();
+            present.pop_front();
+            if(!have)
+                break;
+            advance(true);
+        }
+    }
+
+    // give up on missing counter values before 'target', delivering those held.
+    void skip(epicsUInt32 target, std::vector<PKT>& ready)
+    {
+        while(epicsInt32(target - next) > 0) {
+            if(held.empty()) {
+                epicsUInt32 count = target - next;
+                blk->seqLost += count;
+                next = target;
+                history = count>=64u ? 0u : history<<count;
+                break;
+            }
+            // 'next' is missing, else it would have been delivered
+            blk->seqLost++;
+            advance(false);
+            release(ready);
+        }
+    }
+};
+
+#endif // PSC_SEQCHECK_H
@@ -0,0 +1,56 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef PSC_THREAD_H
+#define PSC_THREAD_H
+
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Placement of driver threads.  See setPSCThread() and setPSCThreadNode()
+ *
+ * Policies are looked up by thread name (eg. "udpfrx"), optionally
+ * qualified by instance name (eg. "udpfrx:fast").  The qualified name
+ * takes precedence.  'instance' may be NULL.
+ */
+
+/* Apply CPU affinity, SCHED_FIFO priority, and NUMA memory policy to the calling thread.
+ * Called by each driver thread as it starts.
+ */
+PSC_API
+void pscThreadApply(const char *name, const char *instance);
+
+/* NUMA node configured for a thread, or -1 */
+PSC_API
+int pscThreadNode(const char *name, const char *instance);
+
+/* NUMA memory policy of a thread, as saved by pscThreadPreferNode() */
+typedef struct {
+    int mode;
+    unsigned long mask;
+} pscNodePolicy;
+
+/* Prefer allocating memory for the calling thread on 'node'.
+ * If 'prev' is not NULL, the previous policy is first saved there,
+ * to be put back by pscThreadRestoreNode().
+ * Returns 0 on success.
+ */
+PSC_API
+int pscThreadPreferNode(int node, pscNodePolicy *prev);
+
+/* Restore a policy saved by pscThreadPreferNode().  Returns 0 on success. */
+PSC_API
+int pscThreadRestoreNode(const pscNodePolicy *prev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PSC_THREAD_H */
@@ -20,6 +20,7 @@
 
 #define epicsExportSharedSymbols
 #include "psc/device.h"
+#include "psc/thread.h"
 
 #include "utilpvt.h"
 
@@ -39,6 +40,9 @@ Block::Block(PSCBase *p, epicsUInt16 c)
     ,count(0u)
     ,scanCount(0u)
     ,scanOflow(0u)
+    ,seqLost(0u)
+    ,seqDup(0u)
+    ,seqReorder(0u)
 {
     scanIoInit(&scan);
     scanIoSetComplete(scan, &Block::scanned, this);
@@ -119,6 +123,16 @@ Block* PSCBase::getRecv(epicsUInt16 block)
     return ret.release();
 }
 
+void PSCBase::setRecvSequence(epicsUInt16, epicsUInt32, epicsUInt32)
+{
+    throw std::runtime_error("Sequence checking not supported");
+}
+
+void PSCBase::joinMulticast(const std::string&, const std::string&)
+{
+    throw std::runtime_error("Multicast not supported");
+}
+
 /* queue the requested register block */
 void PSCBase::send(epicsUInt16 bid)
 {
@@ -226,6 +240,43 @@ void setPSCSendBlockSize(const char* name, int bid, int size)
     }
 }
 
+extern "C"
+void setPSCRecvSequence(const char* name, int bid, int offset, int window)
+{
+    try {
+        PSCBase *psc = PSCBase::getPSCBase(name);
+        if(!psc)
+            throw std::runtime_error("Unknown PSC");
+        // window is held in memory, so keep it small
+        if(bid<0 || bid>0xffff || offset<0 || window<0 || window>4096)
+            throw std::runtime_error("Invalid block, offset, or window");
+        Guard G(psc->lock);
+        psc->setRecvSequence(bid, offset, window);
+    }catch(std::exception& e){
+        iocshSetError(1);
+        timefprintf(stderr, "Failed to set PSC '%s' recv block %d sequence: %s\n",
+                name, bid, e.what());
+    }
+}
+
+extern "C"
+void setPSCMulticast(const char* name, const char* group, const char* iface)
+{
+    try {
+        PSCBase *psc = PSCBase::getPSCBase(name);
+        if(!psc)
+            throw std::runtime_error("Unknown PSC");
+        if(!group)
+            throw std::runtime_error("Multicast group required");
+        Guard G(psc->lock);
+        psc->joinMulticast(group, iface ? iface : "");
+    }catch(std::exception& e){
+        iocshSetError(1);
+        timefprintf(stderr, "Failed to set PSC '%s' multicast group %s: %s\n",
+                name, group ? group : "", e.what());
+    }
+}
+
 static void PSCAtExit(void*)
 {
     PSCBase::stopAll();
@@ -248,6 +299,9 @@ bool pscreportblock(int lvl, Block* block)
            (unsigned long)block->data.size(),
            (unsigned)block->scanCount,
            (unsigned)block->scanOflow);
+    if(block->seqLost || block->seqDup || block->seqReorder)
+        printf("  SeqLost: %u  SeqDup: %u  SeqReorder: %u\n",
+               (unsigned)block->seqLost, (unsigned)block->seqDup, (unsigned)block->seqReorder);
     return true;
 }
 
@@ -326,6 +380,53 @@ static void setPSCCallFunc(const iocshArgBuf *args)
     setPSCSendBlockSize(args[0].sval, args[1].ival, args[2].ival);
 }
 
+static const iocshArg setPSCRecvSeqArg0 = {"name", iocshArgString};
+static const iocshArg setPSCRecvSeqArg1 = {"block", iocshArgInt};
+static const iocshArg setPSCRecvSeqArg2 = {"offset", iocshArgInt};
+static const iocshArg setPSCRecvSeqArg3 = {"window", iocshArgInt};
+static const iocshArg * const setPSCRecvSeqArgs[] =
+{&setPSCRecvSeqArg0,&setPSCRecvSeqArg1,&setPSCRecvSeqArg2,&setPSCRecvSeqArg3};
+static const iocshFuncDef setPSCRecvSeqDef = {"setPSCRecvSequence", 4, setPSCRecvSeqArgs};
+static void setPSCRecvSeqCallFunc(const iocshArgBuf *args)
+{
+    setPSCRecvSequence(args[0].sval, args[1].ival, args[2].ival, args[3].ival);
+}
+
+static const iocshArg setPSCMulticastArg0 = {"name", iocshArgString};
+static const iocshArg setPSCMulticastArg1 = {"group", iocshArgString};
+static const iocshArg setPSCMulticastArg2 = {"iface address", iocshArgString};
+static const iocshArg * const setPSCMulticastArgs[] =
+{&setPSCMulticastArg0,&setPSCMulticastArg1,&setPSCMulticastArg2};
+static const iocshFuncDef setPSCMulticastDef = {"setPSCMulticast", 3, setPSCMulticastArgs};
+static void setPSCMulticastCallFunc(const iocshArgBuf *args)
+{
+    setPSCMulticast(args[0].sval, args[1].sval, args[2].sval);
+}
+
+extern "C" void setPSCThread(const char *name, const char *cpus, int prio);
+extern "C" void setPSCThreadNode(const char *name, int node);
+
+static const iocshArg setPSCThreadArg0 = {"thread[:instance]", iocshArgString};
+static const iocshArg setPSCThreadArg1 = {"cpus", iocshArgString};
+static const iocshArg setPSCThreadArg2 = {"fifo priority", iocshArgInt};
+static const iocshArg * const setPSCThreadArgs[] =
+{&setPSCThreadArg0,&setPSCThreadArg1,&setPSCThreadArg2};
+static const iocshFuncDef setPSCThreadDef = {"setPSCThread", 3, setPSCThreadArgs};
+static void setPSCThreadCallFunc(const iocshArgBuf *args)
+{
+    setPSCThread(args[0].sval, args[1].sval, args[2].ival);
+}
+
+static const iocshArg setPSCThreadNodeArg0 = {"thread[:instance]", iocshArgString};
+static const iocshArg setPSCThreadNodeArg1 = {"NUMA node", iocshArgInt};
+static const iocshArg * const setPSCThreadNodeArgs[] =
+{&setPSCThreadNodeArg0,&setPSCThreadNodeArg1};
+static const iocshFuncDef setPSCThreadNodeDef = {"setPSCThreadNode", 2, setPSCThreadNodeArgs};
+static void setPSCThreadNodeCallFunc(const iocshArgBuf *args)
+{
+    setPSCThreadNode(args[0].sval, args[1].ival);
+}
+
 static void PSCRegister(void)
 {
     int ret =
@@ -344,6 +445,10 @@ static void PSCRegister(void)
     iocshRegister(&createPSCDef, &createPSCArgsCallFunc);
     iocshRegister(&createPSCUDPDef, &createPSCUDPArgsCallFunc);
     iocshRegister(&setPSCDef, &setPSCCallFunc);
+    iocshRegister(&setPSCRecvSeqDef, &setPSCRecvSeqCallFunc);
+    iocshRegister(&setPSCMulticastDef, &setPSCMulticastCallFunc);
+    iocshRegister(&setPSCThreadDef, &setPSCThreadCallFunc);
+    iocshRegister(&setPSCThreadNodeDef, &setPSCThreadNodeCallFunc);
     initHookRegister(&PSCHook);
 }
 
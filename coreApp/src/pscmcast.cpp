@@ -0,0 +1,50 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include <cstring>
+#include <cerrno>
+
+#include <event2/util.h>
+
+#include <osiSock.h>
+
+#define epicsExportSharedSymbols
+#include "psc/mcast.h"
+
+int pscJoinMulticast(int sock, const char *group, const char *iface, const struct sockaddr_in *source)
+{
+    in_addr grp, ifa;
+    memset(&grp, 0, sizeof(grp));
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.s_addr = htonl(INADDR_ANY);
+
+    if(!group || evutil_inet_pton(AF_INET, group, &grp)!=1 || !IN_MULTICAST(ntohl(grp.s_addr)))
+        return EINVAL;
+    if(iface && iface[0] && evutil_inet_pton(AF_INET, iface, &ifa)!=1)
+        return EINVAL;
+
+    int ret;
+    if(source) {
+#ifdef IP_ADD_SOURCE_MEMBERSHIP
+        ip_mreq_source req;
+        memset(&req, 0, sizeof(req));
+        req.imr_multiaddr = grp;
+        req.imr_interface = ifa;
+        req.imr_sourceaddr = source->sin_addr;
+        ret = setsockopt(sock, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP, (char*)&req, sizeof(req));
+#else
+        return ENOTSUP;
+#endif
+    } else {
+        ip_mreq req;
+        memset(&req, 0, sizeof(req));
+        req.imr_multiaddr = grp;
+        req.imr_interface = ifa;
+        ret = setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&req, sizeof(req));
+    }
+    return ret ? SOCKERRNO : 0;
+}
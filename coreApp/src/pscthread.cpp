@@ -0,0 +1,256 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsStdlib.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#ifdef __linux__
+#  include <sched.h>
+#  include <pthread.h>
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#  include <linux/mempolicy.h>
+#endif
+
+#define epicsExportSharedSymbols
+#include "psc/device.h"
+#include "psc/thread.h"
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+struct Policy {
+    std::string cpus; // eg. "2,4-5".  Empty for unchanged
+    int prio;         // SCHED_FIFO priority.  0 for unchanged
+    int node;         // NUMA node.  -1 for unchanged
+    Policy() :prio(0), node(-1) {}
+};
+typedef std::map<std::string, Policy> policies_t;
+
+// set from iocsh, read as each thread starts
+epicsMutex policyLock;
+policies_t policies;
+
+bool lookup(const char *name, const char *instance, Policy& out, std::string& key)
+{
+    Guard G(policyLock);
+    policies_t::const_iterator it(policies.end());
+    if(instance) {
+        key = name;
+        key += ':';
+        key += instance;
+        it = policies.find(key);
+    }
+    if(it==policies.end()) {
+        key = name;
+        it = policies.find(key);
+    }
+    if(it==policies.end())
+        return false;
+    out = it->second;
+    return true;
+}
+
+#ifdef __linux__
+// parse a cpu list, eg. "0,2-3"
+bool parseCPUs(const std::string& spec, cpu_set_t& set)
+{
+    CPU_ZERO(&set);
+    std::istringstream strm(spec);
+    std::string item;
+    bool any = false;
+    while(std::getline(strm, item, ',')) {
+        if(item.empty())
+            continue;
+        unsigned first, last;
+        size_t sep = item.find('-');
+        if(epicsParseUInt32(item.substr(0, sep).c_str(), &first, 10, 0))
+            return false;
+        if(sep==item.npos)
+            last = first;
+        else if(epicsParseUInt32(item.substr(sep+1).c_str(), &last, 10, 0))
+            return false;
+        if(last<first || last>=CPU_SETSIZE)
+            return false;
+        for(unsigned cpu=first; cpu<=last; cpu++)
+            CPU_SET(cpu, &set);
+        any = true;
+    }
+    return any;
+}
+
+bool nodeCPUs(int node, cpu_set_t& set)
+{
+    std::ostringstream fname;
+    fname<<"/sys/devices/system/node/node"<<node<<"/cpulist";
+    std::ifstream strm(fname.str().c_str());
+    std::string spec;
+    if(!std::getline(strm, spec))
+        return false;
+    return parseCPUs(spec, set);
+}
+#endif
+
+void setPolicy(const char *name, int (*fn)(Policy&, const char *, int), const char *sarg, int iarg)
+{
+    try {
+        if(!name || !name[0])
+            throw std::runtime_error("Thread name required");
+        Guard G(policyLock);
+        Policy P;
+        policies_t::const_iterator it(policies.find(name));
+        if(it!=policies.end())
+            P = it->second;
+        if(fn(P, sarg, iarg))
+            throw std::runtime_error("Invalid argument");
+        policies[name] = P;
+    }catch(std::exception& e){
+        iocshSetError(1);
+        timefprintf(stderr, "Failed to set thread policy for '%s': %s\n", name ? name : "", e.what());
+    }
+}
+
+int setCPUs(Policy& P, const char *cpus, int prio)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    if(cpus && cpus[0] && !parseCPUs(cpus, set))
+        return 1;
+    if(prio<0 || prio>sched_get_priority_max(SCHED_FIFO))
+        return 1;
+#endif
+    P.cpus = cpus ? cpus : "";
+    P.prio = prio;
+    return 0;
+}
+
+int setNode(Policy& P, const char *, int node)
+{
+    if(node<-1 || node>=int(8u*sizeof(unsigned long)))
+        return 1;
+    P.node = node;
+    return 0;
+}
+
+} // namespace
+
+void pscThreadApply(const char *name, const char *instance)
+{
+    Policy P;
+    std::string key;
+    if(!lookup(name, instance, P, key))
+        return;
+
+#ifdef __linux__
+    cpu_set_t set;
+    bool haveset = false;
+    if(!P.cpus.empty())
+        haveset = parseCPUs(P.cpus, set);
+    else if(P.node>=0)
+        haveset = nodeCPUs(P.node, set);
+
+    if(haveset) {
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if(err)
+            errlogPrintf("%s : unable to set CPU affinity : %s (%d)\n", key.c_str(), strerror(err), err);
+    } else if(!P.cpus.empty() || P.node>=0) {
+        errlogPrintf("%s : unable to determine CPU set\n", key.c_str());
+    }
+
+    if(P.prio>0) {
+        // requires CAP_SYS_NICE or RLIMIT_RTPRIO
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = P.prio;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if(err)
+            errlogPrintf("%s : unable to set SCHED_FIFO %d : %s (%d)\n", key.c_str(), P.prio, strerror(err), err);
+    }
+
+    if(P.node>=0 && pscThreadPreferNode(P.node, NULL)) {
+        int err = errno;
+        errlogPrintf("%s : unable to prefer NUMA node %d : %s (%d)\n", key.c_str(), P.node, strerror(err), err);
+    }
+
+    if(PSCDebug>=1)
+        errlogPrintf("%s : thread policy cpus='%s' prio=%d node=%d\n",
+                     key.c_str(), P.cpus.c_str(), P.prio, P.node);
+#else
+    errlogPrintf("%s : thread policy not supported on this target\n", key.c_str());
+#endif
+}
+
+int pscThreadNode(const char *name, const char *instance)
+{
+    Policy P;
+    std::string key;
+    if(!lookup(name, instance, P, key))
+        return -1;
+    return P.node;
+}
+
+int pscThreadPreferNode(int node, pscNodePolicy *prev)
+{
+#ifdef __linux__
+    if(node<0 || node>=int(8u*sizeof(unsigned long))) {
+        errno = EINVAL;
+        return -1;
+    }
+    // like libnuma, pass one more than the # of bits
+    if(prev) {
+        prev->mode = MPOL_DEFAULT;
+        prev->mask = 0u;
+        if(syscall(SYS_get_mempolicy, &prev->mode, &prev->mask, 8u*sizeof(prev->mask)+1u, NULL, 0ul))
+            return -1;
+    }
+    unsigned long mask = 1ul<<node;
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, 8u*sizeof(mask)+1u);
+#else
+    (void)node;
+    (void)prev;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int pscThreadRestoreNode(const pscNodePolicy *prev)
+{
+#ifdef __linux__
+    // MPOL_DEFAULT must be given no mask.  mode includes any MPOL_F_* flags
+    if(prev->mode==MPOL_DEFAULT)
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0ul);
+    return syscall(SYS_set_mempolicy, prev->mode, &prev->mask, 8u*sizeof(prev->mask)+1u);
+#else
+    (void)prev;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+extern "C"
+void setPSCThread(const char *name, const char *cpus, int prio)
+{
+    setPolicy(name, &setCPUs, cpus, prio);
+}
+
+extern "C"
+void setPSCThreadNode(const char *name, int node)
+{
+    setPolicy(name, &setNode, 0, node);
+}
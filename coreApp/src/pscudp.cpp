@@ -19,6 +19,7 @@
 
 #define epicsExportSharedSymbols
 #include "psc/device.h"
+#include "psc/mcast.h"
 
 #define HEADER_SIZE 8
 
@@ -179,6 +180,14 @@ void PSCUDP::recvdata(short evt)
         conncount++;
         message = "Rx timeout";
         scanIoRequest(scan);
+
+        // sender is quiet, so stop waiting for missing messages
+        for(seqcheck_t::iterator it = seqCheck.begin(), end = seqCheck.end(); it!=end; ++it) {
+            it->second.flush(seqReady);
+            for(size_t i=0, N=seqReady.size(); i<N; i++)
+                recvblock(it->first, &seqReady[i][HEADER_SIZE], seqReady[i].size()-HEADER_SIZE);
+            seqReady.clear();
+        }
         return;
 
     } else if(!(evt&EV_READ)) {
@@ -260,25 +269,22 @@ void PSCUDP::recvdata(short evt)
             timefprintf(stderr, "%s: recv'd block %u with %lu bytes\n",
                     name.c_str(), header, (unsigned long)bodylen);
 
-        block_map::const_iterator it=recv_blocks.find(header);
-        if(it!=recv_blocks.end()) {
-            Block& bodyblock = *it->second;
-            try {
-                bodyblock.rxtime = epicsTime::getCurrent();
-            } catch(...) {
-                bodyblock.rxtime = epicsTime();
-            }
-            bodyblock.count++;
+        seqcheck_t::iterator sit = seqCheck.find(header);
+        if(sit!=seqCheck.end() && bodylen >= sit->second.offset+4u) {
+            epicsUInt32 seq;
+            memcpy(&seq, hbuf+HEADER_SIZE+sit->second.offset, 4u);
+            seq = ntohl(seq);
 
-            bodyblock.data.assign(hbuf+8, bodylen);
+            buffer_t msg(hbuf, hbuf+HEADER_SIZE+bodylen);
+            if(!sit->second.push(seq, msg, seqReady) && PSCDebug>2)
+                timefprintf(stderr, "%s: discard block %u seq %u\n", name.c_str(), header, (unsigned)seq);
+
+            for(size_t i=0, N=seqReady.size(); i<N; i++)
+                recvblock(header, &seqReady[i][HEADER_SIZE], seqReady[i].size()-HEADER_SIZE);
+            seqReady.clear();
 
-            bodyblock.requestScan();
-            bodyblock.listeners(&bodyblock);
         } else {
-            ukncount++;
-            /* ignore valid, but uninteresting message body */
-            if(PSCDebug>2)
-                timefprintf(stderr, "%s: ignore message %u\n", name.c_str(), header);
+            recvblock(header, hbuf+HEADER_SIZE, bodylen);
         }
     }
 
@@ -290,6 +296,47 @@ void PSCUDP::recvdata(short evt)
                     name.c_str(), npkt, nloop);
 }
 
+void PSCUDP::recvblock(epicsUInt16 header, const char *body, epicsUInt32 bodylen)
+{
+    block_map::const_iterator it=recv_blocks.find(header);
+    if(it!=recv_blocks.end()) {
+        Block& bodyblock = *it->second;
+        try {
+            bodyblock.rxtime = epicsTime::getCurrent();
+        } catch(...) {
+            bodyblock.rxtime = epicsTime();
+        }
+        bodyblock.count++;
+
+        bodyblock.data.assign(body, bodylen);
+
+        bodyblock.requestScan();
+        bodyblock.listeners(&bodyblock);
+    } else {
+        ukncount++;
+        /* ignore valid, but uninteresting message body */
+        if(PSCDebug>2)
+            timefprintf(stderr, "%s: ignore message %u\n", name.c_str(), header);
+    }
+}
+
+void PSCUDP::setRecvSequence(epicsUInt16 block, epicsUInt32 offset, epicsUInt32 window)
+{
+    if(seqCheck.find(block)!=seqCheck.end())
+        throw std::runtime_error("Sequence checking already enabled");
+    Block *blk = getRecv(block);
+    seqCheck.insert(std::make_pair(block, seqwindow_t(blk, offset, window)));
+}
+
+void PSCUDP::joinMulticast(const std::string& group, const std::string& iface)
+{
+    // bound to INADDR_ANY, so receives the group on our port.  recvdata() still checks the source port.
+    if(int err = pscJoinMulticast(socket, group.c_str(), iface.c_str(), &ep))
+        throw std::runtime_error("Unable to join "+group+" : "+evutil_socket_error_to_string(err));
+    if(PSCDebug>0)
+        timefprintf(stderr, "%s: joined multicast group %s\n", name.c_str(), group.c_str());
+}
+
 void PSCUDP::flushSend()
 {
     if(!connected)
@@ -0,0 +1,30 @@
+#!../../bin/linux-x86_64/pscdemo
+
+## Soak test of UDPFast with the loopback load generator.
+## In another terminal run eg.
+##   ./udpApp/src/O.linux-x86_64/benchudpfast -l 8766 -p SOAK: -c <IOC pid> -r 100000 -u 20000 127.0.0.1:8765
+## See documentation/udpfast.rst
+
+## Register all support components
+dbLoadDatabase("../../dbd/pscdemo.dbd",0,0)
+pscdemo_registerRecordDeviceDriver(pdbbase) 
+
+var(PSCDebug, 1)
+var(PSCUDPMaxPacketRate, 1000000)
+# kernel RX timestamps for SOAK:LatRx-I
+var(PSCUDPRxTimestamp, 1)
+
+# sudo sysctl net.core.rmem_max=3407872
+var(PSCUDPSetSockBuf, 3407872)
+
+# Listen on 0.0.0.0:8765 for messages from the generator on localhost:8766
+createPSCUDPFast("soak", "127.0.0.1", 8766, 8765)
+
+dbLoadRecords("../../db/psc-ctrl.db", "NAME=soak,P=SOAK:")
+dbLoadRecords("../../db/pscudpfast.db", "NAME=soak,P=SOAK:")
+
+iocInit()
+
+# To include file writing, set eg.
+#   dbpf SOAK:FileDir-SP /tmp/
+#   dbpf SOAK:Record-Sel 1
@@ -38,6 +38,7 @@
 #include <fftw3.h>
 
 #include "psc/devcommon.h"
+#include "psc/thread.h"
 #include "fftwrap.h"
 
 namespace {
@@ -536,6 +537,7 @@ try{
 
 void Calc::run()
 {
+    pscThreadApply("PSDCalc", name.c_str());
     while(1) {
         wake.wait();
         PTimer runtime;
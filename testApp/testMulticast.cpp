@@ -0,0 +1,143 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+/* Multicast reception over the loopback interface.  See setPSCMulticast()
+ */
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+#include <osiSock.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "psc/mcast.h"
+
+namespace {
+
+const char group[] = "239.255.42.1";
+
+struct Sock {
+    SOCKET sock;
+    osiSockAddr addr; // after bind()
+
+    explicit Sock(const char *ip) :sock(epicsSocketCreate(AF_INET, SOCK_DGRAM, 0)) {
+        if(sock==INVALID_SOCKET)
+            testAbort("Unable to create socket");
+        memset(&addr, 0, sizeof(addr));
+        addr.ia.sin_family = AF_INET;
+        addr.ia.sin_port = 0;
+        if(aToIPAddr(ip, 0, &addr.ia) || bind(sock, &addr.sa, sizeof(addr.ia))) {
+            epicsSocketDestroy(sock);
+            sock = INVALID_SOCKET;
+            return;
+        }
+        osiSocklen_t len = sizeof(addr);
+        if(getsockname(sock, &addr.sa, &len))
+            testAbort("Unable to getsockname()");
+    }
+    ~Sock() {
+        if(sock!=INVALID_SOCKET)
+            epicsSocketDestroy(sock);
+    }
+
+    bool ok() const { return sock!=INVALID_SOCKET; }
+
+    // send group traffic out through loopback
+    void sender() {
+        in_addr lo;
+        lo.s_addr = htonl(INADDR_LOOPBACK);
+        unsigned char loop = 1;
+        if(setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, (char*)&lo, sizeof(lo))
+                || setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, (char*)&loop, sizeof(loop)))
+            testAbort("Unable to set IP_MULTICAST_IF/LOOP");
+    }
+
+    void send(unsigned short port, const char *msg) {
+        osiSockAddr dest;
+        memset(&dest, 0, sizeof(dest));
+        if(aToIPAddr(group, port, &dest.ia))
+            testAbort("Bad group");
+        if(sendto(sock, msg, strlen(msg), 0, &dest.sa, sizeof(dest.ia))<0)
+            testAbort("Unable to send to group : %d", SOCKERRNO);
+    }
+
+    // collect everything arriving within a short time
+    std::string recvAll() {
+        std::string ret;
+        timeval timeout = {0, 200000};
+        (void)setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+        char buf[64];
+        int n;
+        while((n = recv(sock, buf, sizeof(buf), 0))>0)
+            ret.append(buf, n);
+        return ret;
+    }
+};
+
+void testArgs()
+{
+    testDiag("Argument checking");
+    Sock rx("0.0.0.0");
+
+    testOk1(pscJoinMulticast(rx.sock, "127.0.0.1", 0, 0)==EINVAL);
+    testOk1(pscJoinMulticast(rx.sock, "not.an.address", 0, 0)==EINVAL);
+    testOk1(pscJoinMulticast(rx.sock, 0, 0, 0)==EINVAL);
+    testOk1(pscJoinMulticast(rx.sock, group, "junk", 0)==EINVAL);
+}
+
+void testLoopback()
+{
+    testDiag("Loopback reception of %s", group);
+
+    // a second loopback source address distinguishes sources
+    Sock txA("127.0.0.1"), txB("127.0.0.2");
+    Sock ssm("0.0.0.0"), any("0.0.0.0");
+
+    int err = pscJoinMulticast(ssm.sock, group, "127.0.0.1", &txA.addr.ia);
+    if(err) {
+        testDiag("Unable to join multicast group on loopback : %s", strerror(err));
+        testSkip(5, "No loopback multicast");
+        return;
+    }
+    testPass("source specific join");
+
+    testOk1(pscJoinMulticast(any.sock, group, "127.0.0.1", 0)==0);
+
+    txA.sender();
+    txA.send(ntohs(ssm.addr.ia.sin_port), "A");
+
+    testOk1(ssm.recvAll()=="A");
+
+    if(!txB.ok()) {
+        testSkip(2, "No 127.0.0.2");
+        return;
+    }
+    txB.sender();
+    txB.send(ntohs(ssm.addr.ia.sin_port), "B");
+    txA.send(ntohs(ssm.addr.ia.sin_port), "C");
+
+    // source B filtered out
+    testOk1(ssm.recvAll()=="C");
+
+    // any source, on its own port
+    txB.send(ntohs(any.addr.ia.sin_port), "D");
+    txA.send(ntohs(any.addr.ia.sin_port), "E");
+    testOk1(any.recvAll()=="DE");
+}
+
+} // namespace
+
+MAIN(testMulticast)
+{
+    testPlan(9);
+    osiSockAttach();
+    testArgs();
+    testLoopback();
+    osiSockRelease();
+    return testDone();
+}
@@ -0,0 +1,246 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+/* Sequence counter checking and reordering.  See psc/seqcheck.h
+ */
+
+#include <vector>
+#include <algorithm>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "psc/seqcheck.h"
+
+namespace {
+
+struct TestBlock {
+    epicsUInt32 seqLost, seqDup, seqReorder;
+    TestBlock() :seqLost(0u), seqDup(0u), seqReorder(0u) {}
+};
+
+struct TestPkt {
+    epicsUInt32 seq;
+    bool valid;
+    TestPkt() :seq(0u), valid(false) {}
+    explicit TestPkt(epicsUInt32 seq) :seq(seq), valid(true) {}
+    void swap(TestPkt& o) {
+        std::swap(seq, o.seq);
+        std::swap(valid, o.valid);
+    }
+};
+
+typedef SeqWindow<TestPkt, TestBlock> window_t;
+typedef std::vector<TestPkt> pkts_t;
+
+// push 'seq', and return whether it was kept
+bool push(window_t& win, epicsUInt32 seq, pkts_t& ready)
+{
+    TestPkt pkt(seq);
+    bool keep = win.push(seq, pkt, ready);
+    if(keep && pkt.valid)
+        testFail("kept %u without taking it", unsigned(seq));
+    return keep;
+}
+
+// check 'ready' against 'expect', then clear
+void testReady(pkts_t& ready, const epicsUInt32 *expect, size_t n)
+{
+    bool ok = ready.size()==n;
+    for(size_t i=0; ok && i<n; i++)
+        ok = ready[i].valid && ready[i].seq==expect[i];
+    testOk(ok, "ready %u packets, expect %u", unsigned(ready.size()), unsigned(n));
+    if(!ok) {
+        for(size_t i=0; i<ready.size(); i++)
+            testDiag("  [%u] %u", unsigned(i), unsigned(ready[i].seq));
+    }
+    ready.clear();
+}
+
+void testCounts(const TestBlock& blk, epicsUInt32 lost, epicsUInt32 dup, epicsUInt32 reorder)
+{
+    testOk(blk.seqLost==lost && blk.seqDup==dup && blk.seqReorder==reorder,
+           "lost %u==%u dup %u==%u reorder %u==%u",
+           unsigned(blk.seqLost), unsigned(lost),
+           unsigned(blk.seqDup), unsigned(dup),
+           unsigned(blk.seqReorder), unsigned(reorder));
+}
+
+void testInOrder()
+{
+    testDiag("In order");
+    TestBlock blk;
+    window_t win(&blk, 0u, 4u);
+    pkts_t ready;
+
+    bool keep = true;
+    for(epicsUInt32 i=100u; i<105u; i++)
+        keep &= push(win, i, ready);
+    testOk1(keep);
+    const epicsUInt32 expect[] = {100u, 101u, 102u, 103u, 104u};
+    testReady(ready, expect, 5u);
+    testOk1(win.holding()==0u);
+    testCounts(blk, 0u, 0u, 0u);
+}
+
+void testReorder()
+{
+    testDiag("Reordered");
+    TestBlock blk;
+    window_t win(&blk, 0u, 4u);
+    pkts_t ready;
+
+    testOk1(push(win, 1u, ready));
+    testOk1(push(win, 3u, ready));
+    testOk1(push(win, 4u, ready));
+    testOk1(win.holding()==2u);
+    {
+        const epicsUInt32 expect[] = {1u};
+        testReady(ready, expect, 1u);
+    }
+    testOk1(push(win, 2u, ready));
+    testOk1(win.holding()==0u);
+    {
+        const epicsUInt32 expect[] = {2u, 3u, 4u};
+        testReady(ready, expect, 3u);
+    }
+    testCounts(blk, 0u, 0u, 1u);
+}
+
+void testDuplicate()
+{
+    testDiag("Duplicate");
+    TestBlock blk;
+    window_t win(&blk, 0u, 4u);
+    pkts_t ready;
+
+    testOk1(push(win, 1u, ready));
+    testOk1(!push(win, 1u, ready)); // already delivered
+    testOk1(push(win, 3u, ready));
+    testOk1(!push(win, 3u, ready)); // already held
+    testOk1(push(win, 2u, ready));
+    testOk1(!push(win, 2u, ready));
+    const epicsUInt32 expect[] = {1u, 2u, 3u};
+    testReady(ready, expect, 3u);
+    testCounts(blk, 0u, 3u, 1u);
+}
+
+void testSkip()
+{
+    testDiag("Give up on a gap when the sender is quiet, or the window is full");
+    TestBlock blk;
+    window_t win(&blk, 0u, 4u);
+    pkts_t ready;
+
+    testOk1(push(win, 1u, ready));
+    testOk1(push(win, 3u, ready));
+    testOk1(push(win, 5u, ready));
+    // timeout
+    win.flush(ready);
+    testOk1(win.holding()==0u);
+    {
+        const epicsUInt32 expect[] = {1u, 3u, 5u};
+        testReady(ready, expect, 3u);
+    }
+    testCounts(blk, 2u, 0u, 0u);
+
+    // arrives after being skipped over.  Un-counted as lost, but too late to deliver.
+    testOk1(!push(win, 2u, ready));
+    testOk1(ready.empty());
+    testCounts(blk, 1u, 0u, 1u);
+    // a second copy is a duplicate
+    testOk1(!push(win, 2u, ready));
+    testCounts(blk, 1u, 1u, 1u);
+
+    // 6 is missing.  7-10 fill the window, then 11 forces 6 to be skipped.
+    for(epicsUInt32 i=7u; i<=10u; i++)
+        testOk1(push(win, i, ready));
+    testOk1(ready.empty() && win.holding()==4u);
+    testOk1(push(win, 11u, ready));
+    testOk1(win.holding()==0u);
+    {
+        const epicsUInt32 expect[] = {7u, 8u, 9u, 10u, 11u};
+        testReady(ready, expect, 5u);
+    }
+    testCounts(blk, 2u, 1u, 1u);
+}
+
+void testCountOnly()
+{
+    testDiag("Zero window only counts");
+    TestBlock blk;
+    window_t win(&blk, 0u, 0u);
+    pkts_t ready;
+
+    testOk1(push(win, 1u, ready));
+    testOk1(push(win, 3u, ready));
+    testOk1(push(win, 2u, ready)); // late, but delivered
+    testOk1(win.holding()==0u);
+    const epicsUInt32 expect[] = {1u, 3u, 2u};
+    testReady(ready, expect, 3u);
+    testCounts(blk, 0u, 0u, 1u);
+}
+
+void testWrap()
+{
+    testDiag("Counter wrap");
+    {
+        // past 16 bits is not special
+        TestBlock blk;
+        window_t win(&blk, 0u, 4u);
+        pkts_t ready;
+
+        testOk1(push(win, 0xfffeu, ready));
+        testOk1(push(win, 0x10000u, ready));
+        testOk1(push(win, 0xffffu, ready));
+        const epicsUInt32 expect[] = {0xfffeu, 0xffffu, 0x10000u};
+        testReady(ready, expect, 3u);
+        testCounts(blk, 0u, 0u, 1u);
+    }
+    {
+        // 32-bit wrap, with a reorder across it
+        TestBlock blk;
+        window_t win(&blk, 0u, 4u);
+        pkts_t ready;
+
+        testOk1(push(win, 0xfffffffeu, ready));
+        testOk1(push(win, 0u, ready));
+        testOk1(push(win, 1u, ready));
+        testOk1(push(win, 0xffffffffu, ready));
+        testOk1(!push(win, 0u, ready));
+        const epicsUInt32 expect[] = {0xfffffffeu, 0xffffffffu, 0u, 1u};
+        testReady(ready, expect, 4u);
+        testCounts(blk, 0u, 1u, 1u);
+    }
+    {
+        // far behind is taken as a restart of the sender's counter
+        TestBlock blk;
+        window_t win(&blk, 0u, 4u);
+        pkts_t ready;
+
+        testOk1(push(win, 1000u, ready));
+        testOk1(push(win, 1002u, ready));
+        testOk1(push(win, 5u, ready));
+        testOk1(push(win, 6u, ready));
+        const epicsUInt32 expect[] = {1000u, 1002u, 5u, 6u};
+        testReady(ready, expect, 4u);
+        testOk1(win.holding()==0u);
+    }
+}
+
+} // namespace
+
+MAIN(testSeqCheck)
+{
+    testPlan(65);
+    testInOrder();
+    testReorder();
+    testDuplicate();
+    testSkip();
+    testCountOnly();
+    testWrap();
+    return testDone();
+}
@@ -0,0 +1,195 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+/* Striped recording written by StripeWriter, and reassembled by UDPMergeReader.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "udpwriter.h"
+#include "udpreader.h"
+
+namespace {
+
+const unsigned nstripes = 3u;
+const size_t npkts = 200u;
+const size_t chunkPkts = 7u; // packets per chunk
+const size_t batchPkts = 5u; // packets per cache worker batch.  Chunks span batches
+
+const epicsUInt32 t0 = 1617248700u - POSIX_TIME_AT_EPICS_EPOCH;
+
+void makePkts(UDPFast::pkts_t& pkts)
+{
+    pkts.resize(npkts);
+    for(size_t i=0; i<npkts; i++) {
+        UDPFast::pkt& pkt = pkts[i];
+        pkt.msgid = 1u + i%3u;
+        // body length varies.  First 4 bytes are the sequence number
+        pkt.bodylen = 4u + i%13u;
+        pkt.body.resize(pkt.bodylen, char(i));
+        pkt.body[0] = char(i>>24u);
+        pkt.body[1] = char(i>>16u);
+        pkt.body[2] = char(i>>8u);
+        pkt.body[3] = char(i);
+        // several packets share each time, including across chunk boundaries
+        pkt.rxtime.secPastEpoch = t0 + epicsUInt32(i/11u);
+        pkt.rxtime.nsec = 0u;
+    }
+}
+
+epicsUInt32 seqOf(const UDPRecord& rec)
+{
+    const epicsUInt8 *B = reinterpret_cast<const epicsUInt8*>(rec.body);
+    return (epicsUInt32(B[0])<<24u) | (epicsUInt32(B[1])<<16u) | (epicsUInt32(B[2])<<8u) | B[3];
+}
+
+void testStripe()
+{
+    std::vector<std::string> fnames;
+    std::vector<StripeWriter*> stripes;
+    size_t wrote = 0u;
+
+    StripeWriter::Config conf;
+    conf.indexPkts = 10u;
+    conf.wrote = &wrote;
+
+    for(unsigned s=0; s<nstripes; s++) {
+        std::ostringstream strm;
+        strm<<"teststripe-s"<<s;
+        stripes.push_back(new StripeWriter(strm.str(), s, nstripes, conf));
+        fnames.push_back(strm.str()+stripes.back()->extension());
+        unlink(fnames.back().c_str());
+        unlink((fnames.back()+".idx").c_str());
+        stripes.back()->open(fnames.back());
+    }
+
+    UDPFast::pkts_t pkts;
+    makePkts(pkts);
+
+    // deal out consecutive chunks round-robin, as cachefn() does
+    size_t expectLen = 0u;
+    epicsUInt64 chunkSeq = 0u;
+    size_t chunkFill = 0u;
+    bool chunkStart = true;
+    for(size_t b=0; b<npkts; b+=batchPkts) {
+        const size_t N = std::min(npkts, b+batchPkts);
+        size_t begin = b;
+        for(size_t i=b; i<N; i++) {
+            if(chunkFill >= chunkPkts) {
+                if(i>begin)
+                    stripes[chunkSeq%nstripes]->queue(pkts, begin, i, chunkStart, chunkSeq);
+                begin = i;
+                chunkSeq++;
+                chunkFill = 0u;
+                chunkStart = true;
+            }
+            chunkFill++;
+            expectLen += sizeof(FileRecordHeader) + pkts[i].bodylen;
+        }
+        if(N>begin) {
+            stripes[chunkSeq%nstripes]->queue(pkts, begin, N, chunkStart, chunkSeq);
+            chunkStart = false;
+        }
+    }
+    const size_t nchunks = size_t(chunkSeq)+1u;
+    expectLen += sizeof(FileChunkHeader)*nchunks;
+
+    UDPFast::pkts_t done;
+    int err = 0;
+    for(unsigned s=0; s<nstripes; s++)
+        stripes[s]->close();
+    for(unsigned s=0; s<nstripes; s++) {
+        stripes[s]->drain();
+        if(int e = stripes[s]->reap(done))
+            err = e;
+        testOk(!stripes[s]->busy(), "stripe %u idle", s);
+        delete stripes[s];
+    }
+    testOk(err==0, "write error %d", err);
+    testOk(done.size()==npkts, "buffers returned %u", unsigned(done.size()));
+    testOk(wrote==expectLen, "wrote %u == %u", unsigned(wrote), unsigned(expectLen));
+
+    {
+        UDPFilter all;
+        UDPMergeReader reader(all);
+        for(size_t s=0; s<fnames.size(); s++)
+            reader.add(fnames[s]);
+
+        bool striped = true, indexed = true;
+        for(size_t s=0; s<reader.nfiles(); s++) {
+            striped &= reader.file(s).striped();
+            indexed &= reader.file(s).indexed();
+        }
+        testOk1(striped);
+        testOk1(indexed);
+
+        UDPRecord rec;
+        epicsUInt32 n = 0u;
+        bool inorder = true, chunks = true;
+        while(reader.next(rec)) {
+            if(inorder && seqOf(rec)!=n) {
+                testDiag("record %u has seq %u from chunk %llu", unsigned(n), unsigned(seqOf(rec)),
+                         (unsigned long long)rec.chunk);
+                inorder = false;
+            }
+            chunks &= rec.chunk==n/chunkPkts && rec.file==rec.chunk%nstripes;
+            chunks &= rec.msgid==1u + n%3u && rec.bodylen==4u + n%13u;
+            n++;
+        }
+        testOk(n==npkts, "read %u records", unsigned(n));
+        testOk1(inorder);
+        testOk1(chunks);
+        bool complete = true;
+        for(size_t s=0; s<reader.nfiles(); s++)
+            complete &= !reader.pastEnd(s) && reader.position(s)==reader.file(s).size();
+        testOk1(complete);
+    }
+
+    {
+        // a time window beginning part way through a chunk, which seek()s using the .idx
+        UDPFilter filt;
+        filt.begin = (t0 + POSIX_TIME_AT_EPICS_EPOCH + 8u)*epicsUInt64(1000000000u);
+        filt.end = (t0 + POSIX_TIME_AT_EPICS_EPOCH + 12u)*epicsUInt64(1000000000u);
+        UDPMergeReader reader(filt);
+        for(size_t s=0; s<fnames.size(); s++)
+            reader.add(fnames[s]);
+
+        UDPRecord rec;
+        epicsUInt32 n = 8u*11u;
+        bool inorder = true;
+        while(reader.next(rec))
+            inorder &= seqOf(rec)==n++;
+        testOk(inorder && n==12u*11u, "window read through %u", unsigned(n));
+    }
+
+    for(size_t s=0; s<fnames.size(); s++) {
+        unlink(fnames[s].c_str());
+        unlink((fnames[s]+".idx").c_str());
+    }
+}
+
+} // namespace
+
+MAIN(testStripe)
+{
+    testPlan(13);
+    try {
+        testStripe();
+    } catch(std::exception& e) {
+        testAbort("Unexpected exception: %s", e.what());
+    }
+    return testDone();
+}
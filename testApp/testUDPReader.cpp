@@ -0,0 +1,335 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+/* Offline reading of .dat files.  See udpreader.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "udpreader.h"
+
+namespace {
+
+const epicsUInt64 sec = 1000000000u; // ns
+
+void putU16(std::vector<char>& buf, epicsUInt16 val)
+{
+    buf.push_back(char(val>>8u));
+    buf.push_back(char(val));
+}
+
+void putU32(std::vector<char>& buf, epicsUInt32 val)
+{
+    putU16(buf, val>>16u);
+    putU16(buf, val);
+}
+
+// builds the contents of a .dat file, and optionally a .idx
+struct DatFile {
+    const std::string fname;
+    std::vector<char> data, index;
+
+    explicit DatFile(const char *fname) :fname(fname) {}
+    ~DatFile() {
+        unlink(fname.c_str());
+        unlink((fname+".idx").c_str());
+    }
+
+    // body is 4 bytes of 'tag'
+    epicsUInt64 add(epicsUInt16 msgid, epicsUInt64 T, epicsUInt32 tag) {
+        const epicsUInt64 offset = data.size();
+        data.push_back('P');
+        data.push_back('S');
+        putU16(data, msgid);
+        putU32(data, 4u);
+        putU32(data, epicsUInt32(T/sec));
+        putU32(data, epicsUInt32(T%sec));
+        putU32(data, tag);
+        return offset;
+    }
+    // See FileIndexEntry
+    void indexAt(epicsUInt16 msgid, epicsUInt64 T, epicsUInt64 offset) {
+        index.push_back('P');
+        index.push_back('I');
+        putU16(index, msgid);
+        putU32(index, epicsUInt32(T/sec));
+        putU32(index, epicsUInt32(T%sec));
+        putU32(index, epicsUInt32(offset>>32u));
+        putU32(index, epicsUInt32(offset));
+    }
+    void padding(size_t n) {
+        data.resize(data.size()+n, '\0');
+    }
+
+    void write() {
+        save(fname, data);
+        if(!index.empty())
+            save(fname+".idx", index);
+    }
+    static void save(const std::string& fname, const std::vector<char>& buf) {
+        FILE *fp = fopen(fname.c_str(), "wb");
+        if(!fp || fwrite(&buf[0], 1, buf.size(), fp)!=buf.size() || fclose(fp))
+            testAbort("Unable to write %s", fname.c_str());
+    }
+};
+
+epicsUInt32 tagOf(const UDPRecord& rec)
+{
+    const epicsUInt8 *B = reinterpret_cast<const epicsUInt8*>(rec.body);
+    return (epicsUInt32(B[0])<<24u) | (epicsUInt32(B[1])<<16u) | (epicsUInt32(B[2])<<8u) | B[3];
+}
+
+// 10 records, one per second beginning at t0.  msgid alternates 1, 2
+const epicsUInt64 t0 = 1617248700u*sec;
+
+void testFilter()
+{
+    testDiag("Filtered read of one file");
+
+    DatFile F("testudpreader-a.dat");
+    std::vector<epicsUInt64> offsets;
+    for(epicsUInt32 i=0; i<10u; i++)
+        offsets.push_back(F.add(1u + i%2u, t0 + i*sec, i));
+    F.padding(64u); // zero filled tail of a preallocated file
+    F.write();
+
+    UDPDataFile file(F.fname);
+    testOk1(!file.indexed());
+    testOk1(file.size()==F.data.size());
+
+    {
+        UDPFilter all;
+        UDPFileReader reader(file, all);
+        UDPRecord rec;
+        epicsUInt32 n = 0u;
+        bool inorder = true;
+        while(reader.next(rec)) {
+            inorder &= tagOf(rec)==n && rec.offset==offsets[n] && rec.time()==t0 + n*sec;
+            n++;
+        }
+        testOk(n==10u && inorder, "read all %u records in order", unsigned(n));
+        testOk1(!reader.pastEnd());
+        testOk(reader.position()==F.data.size()-64u, "stop at padding %llu",
+               (unsigned long long)reader.position());
+    }
+
+    {
+        UDPFilter filt;
+        filt.allow(2u);
+        filt.begin = t0 + 3u*sec;
+        filt.end = t0 + 7u*sec;
+        UDPFileReader reader(file, filt);
+        UDPRecord rec;
+        std::vector<epicsUInt32> tags;
+        while(reader.next(rec))
+            tags.push_back(tagOf(rec));
+        testOk(tags.size()==2u && tags[0]==3u && tags[1]==5u, "msgid 2 in [3, 7) -> %u records", unsigned(tags.size()));
+        testOk1(reader.pastEnd());
+        // stopped at the first record after the window and slack, without scanning the rest
+        testOk(reader.position()==offsets[8], "stop at end of window %llu",
+               (unsigned long long)reader.position());
+        testOk1(!reader.next(rec));
+    }
+
+    {
+        UDPFilter filt;
+        filt.end = t0; // before all
+        filt.slack = 0u;
+        UDPFileReader reader(file, filt);
+        UDPRecord rec;
+        testOk1(!reader.next(rec));
+        testOk1(reader.pastEnd() && reader.position()==0u);
+    }
+
+    {
+        // a .datz frame header.  See FileFrameHeader
+        DatFile Z("testudpreader-z.datz");
+        Z.data.push_back('P');
+        Z.data.push_back('Z');
+        Z.padding(22u);
+        Z.write();
+        try {
+            UDPDataFile zfile(Z.fname);
+            testFail(".datz accepted");
+        } catch(std::runtime_error& e) {
+            testPass(".datz rejected : %s", e.what());
+        }
+    }
+}
+
+void testIndex()
+{
+    testDiag("Seek with .idx");
+
+    DatFile F("testudpreader-i.dat");
+    std::vector<epicsUInt64> offsets;
+    for(epicsUInt32 i=0; i<10u; i++)
+        offsets.push_back(F.add(1u, t0 + i*sec, i));
+    F.indexAt(1u, t0, offsets[0]);
+    F.indexAt(1u, t0 + 4u*sec, offsets[4]);
+    F.indexAt(1u, t0 + 8u*sec, offsets[8]);
+    F.write();
+
+    UDPDataFile file(F.fname);
+    testOk1(file.indexed());
+    testOk1(file.seek(t0)==0u);
+    // entry before the first at or after the time
+    testOk1(file.seek(t0 + 5u*sec)==offsets[4]);
+    testOk1(file.seek(t0 + 8u*sec)==offsets[4]);
+    testOk1(file.seek(t0 + 9u*sec)==offsets[8]);
+
+    UDPFilter filt;
+    filt.begin = t0 + 6u*sec;
+    filt.end = t0 + 8u*sec;
+    UDPFileReader reader(file, filt);
+    UDPRecord rec;
+    std::vector<epicsUInt32> tags;
+    while(reader.next(rec))
+        tags.push_back(tagOf(rec));
+    testOk(tags.size()==2u && tags[0]==6u && tags[1]==7u, "[6, 8) -> %u records", unsigned(tags.size()));
+}
+
+void testDisorder()
+{
+    testDiag("Records out of time order");
+
+    // tag 3 was held for reordering, and recorded after later packets.  Every record is indexed.
+    DatFile F("testudpreader-o.dat");
+    const epicsUInt64 ms = sec/1000u;
+    const epicsUInt64 times[] = {0u, 1000u*ms, 2000u*ms, 3500u*ms, 3000u*ms, 3100u*ms, 3200u*ms, 3300u*ms, 5000u*ms};
+    std::vector<epicsUInt64> offsets;
+    for(epicsUInt32 i=0; i<9u; i++) {
+        offsets.push_back(F.add(1u, t0 + times[i], i));
+        F.indexAt(1u, t0 + times[i], offsets[i]);
+    }
+    F.write();
+    UDPDataFile file(F.fname);
+
+    {
+        // seek() alone would begin after tag 3
+        UDPFilter filt;
+        filt.begin = t0 + 3400u*ms;
+        filt.end = t0 + 4000u*ms;
+        UDPFileReader reader(file, filt);
+        UDPRecord rec;
+        std::vector<epicsUInt32> tags;
+        while(reader.next(rec))
+            tags.push_back(tagOf(rec));
+        testOk(tags.size()==1u && tags[0]==3u, "[3.4, 4) -> %u records", unsigned(tags.size()));
+        testOk(reader.pastEnd() && reader.position()==offsets[8], "stop after slack %llu",
+               (unsigned long long)reader.position());
+        testOk(reader.disorder()==500u*ms, "disorder %llu", (unsigned long long)reader.disorder());
+    }
+    {
+        // continue past tag 3, which is after the end
+        UDPFilter filt;
+        filt.begin = t0 + 3000u*ms;
+        filt.end = t0 + 3400u*ms;
+        UDPFileReader reader(file, filt);
+        UDPRecord rec;
+        std::vector<epicsUInt32> tags;
+        while(reader.next(rec))
+            tags.push_back(tagOf(rec));
+        testOk(tags.size()==4u && tags[0]==4u && tags[3]==7u, "[3, 3.4) -> %u records", unsigned(tags.size()));
+    }
+    {
+        // without slack, stops at tag 3
+        UDPFilter filt;
+        filt.begin = t0 + 3000u*ms;
+        filt.end = t0 + 3400u*ms;
+        filt.slack = 0u;
+        UDPFileReader reader(file, filt);
+        UDPRecord rec;
+        testOk1(!reader.next(rec));
+        testOk1(reader.pastEnd() && reader.position()==offsets[3]);
+    }
+}
+
+void testMerge()
+{
+    testDiag("Merge two files by time");
+
+    // interleaved, with equal times in both files
+    DatFile A("testudpreader-m0.dat"), B("testudpreader-m1.dat");
+    A.add(1u, t0 + 0u*sec, 0u);
+    B.add(2u, t0 + 1u*sec, 1u);
+    A.add(1u, t0 + 2u*sec, 2u);
+    A.add(1u, t0 + 3u*sec, 3u); // same time as next, earlier file first
+    B.add(2u, t0 + 3u*sec, 4u);
+    B.add(2u, t0 + 5u*sec, 5u);
+    A.add(1u, t0 + 6u*sec, 6u);
+    A.add(1u, t0 + 7u*sec, 7u);
+    A.write();
+    B.write();
+
+    {
+        UDPFilter all;
+        UDPMergeReader reader(all);
+        reader.add(A.fname);
+        reader.add(B.fname);
+        testOk1(reader.nfiles()==2u);
+
+        UDPRecord rec;
+        std::vector<epicsUInt32> tags;
+        bool ordered = true;
+        epicsUInt64 prev = 0u;
+        while(reader.next(rec)) {
+            tags.push_back(tagOf(rec));
+            ordered &= rec.time()>=prev && rec.file==(rec.msgid==1u ? 0u : 1u);
+            prev = rec.time();
+        }
+        bool match = tags.size()==8u;
+        for(size_t i=0; match && i<tags.size(); i++)
+            match = tags[i]==i;
+        testOk(match, "merged order of %u records", unsigned(tags.size()));
+        testOk1(ordered);
+        testOk1(!reader.pastEnd(0u) && reader.position(0u)==A.data.size());
+        testOk1(!reader.pastEnd(1u) && reader.position(1u)==B.data.size());
+    }
+
+    {
+        UDPFilter filt;
+        filt.begin = t0 + 2u*sec;
+        filt.end = t0 + 6u*sec;
+        UDPMergeReader reader(filt);
+        reader.add(A.fname);
+        reader.add(B.fname);
+
+        UDPRecord rec;
+        std::vector<epicsUInt32> tags;
+        while(reader.next(rec))
+            tags.push_back(tagOf(rec));
+        testOk(tags.size()==4u && tags[0]==2u && tags[1]==3u && tags[2]==4u && tags[3]==5u,
+               "merged [2, 6) -> %u records", unsigned(tags.size()));
+        testOk1(reader.pastEnd(0u));
+        // B has no records after the window
+        testOk1(!reader.pastEnd(1u));
+    }
+}
+
+} // namespace
+
+MAIN(testUDPReader)
+{
+    testPlan(32);
+    try {
+        testFilter();
+        testIndex();
+        testDisorder();
+        testMerge();
+    } catch(std::exception& e) {
+        testAbort("Unexpected exception: %s", e.what());
+    }
+    return testDone();
+}
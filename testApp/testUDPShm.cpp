@@ -0,0 +1,261 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+/* Shared memory ring.  See udpshm.h
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAtomic.h>
+
+#include "udpshm.h"
+
+namespace {
+
+// 16 + 48 bytes, so 64 records fill the smallest (4096 byte) ring
+const epicsUInt32 bodyLen = 48u;
+
+std::string shmName()
+{
+    std::ostringstream strm;
+    strm<<"/testudpshm-"<<getpid();
+    return strm.str();
+}
+
+// body bytes are derived from the sequence number, which is also placed in 'nsec'
+char bodyByte(epicsUInt32 seq, size_t i)
+{
+    return char(seq*7u + i);
+}
+
+void putU32(char *buf, epicsUInt32 val)
+{
+    buf[0] = char(val>>24u);
+    buf[1] = char(val>>16u);
+    buf[2] = char(val>>8u);
+    buf[3] = char(val);
+}
+
+void publish(UDPShmWriter& W, epicsUInt32 seq)
+{
+    // See FileRecordHeader
+    char hdr[16] = {'P', 'S', 0, 1};
+    putU32(hdr+4, bodyLen);
+    putU32(hdr+8, 1617248700u);
+    putU32(hdr+12, seq);
+    char body[bodyLen];
+    for(size_t i=0; i<bodyLen; i++)
+        body[i] = bodyByte(seq, i);
+    if(!W.publish(hdr, body, bodyLen))
+        testFail("publish %u", unsigned(seq));
+}
+
+bool intact(const UDPRecord& rec, const char *body)
+{
+    if(rec.msgid!=1u || rec.bodylen!=bodyLen)
+        return false;
+    for(size_t i=0; i<bodyLen; i++) {
+        if(body[i]!=bodyByte(rec.nsec, i))
+            return false;
+    }
+    return true;
+}
+
+void testInOrder()
+{
+    testDiag("Read records as published");
+    UDPShmWriter W(shmName(), 4096u);
+    publish(W, 0u);
+    W.commit();
+
+    // begins after what was already published
+    UDPShmReader R(W.name());
+    UDPRecord rec;
+    testOk1(!R.next(rec));
+    testOk1(R.writer()==epicsUInt32(getpid()));
+
+    for(epicsUInt32 i=1u; i<=5u; i++)
+        publish(W, i);
+    testOk1(!R.next(rec)); // not yet committed
+    W.commit();
+
+    epicsUInt32 n = 0u;
+    bool ok = true;
+    while(R.next(rec)) {
+        ok &= rec.nsec==n+1u && intact(rec, rec.body) && R.valid();
+        n++;
+    }
+    testOk(ok && n==5u, "read %u", unsigned(n));
+
+    // wrap around the end of the ring many times, while keeping up
+    ok = true;
+    for(epicsUInt32 i=6u; i<1000u; i++) {
+        publish(W, i);
+        if(i%10u==0u) {
+            W.commit();
+            while(R.next(rec)) {
+                ok &= rec.nsec==n+1u && intact(rec, rec.body) && R.valid();
+                n++;
+            }
+        }
+    }
+    testOk(ok && n==990u, "wrap read %u", unsigned(n));
+    testOk1(R.overruns()==0u && R.lost()==0u);
+    testOk1(W.npublished==1000u && W.nskipped==0u);
+
+    // can never fit
+    std::vector<char> big(8192u);
+    char hdr[16] = {'P', 'S', 0, 2};
+    testOk1(!W.publish(hdr, &big[0], epicsUInt32(big.size())));
+    testOk1(W.nskipped==1u);
+}
+
+void testOverrun()
+{
+    testDiag("Reader falls behind");
+    UDPShmWriter W(shmName(), 4096u);
+    UDPShmReader R(W.name());
+    UDPRecord rec;
+
+    for(epicsUInt32 i=0u; i<10u; i++)
+        publish(W, i);
+    W.commit();
+
+    // in use while the writer laps the reader
+    testOk1(R.next(rec) && rec.nsec==0u);
+    std::vector<char> copy(rec.body, rec.body+rec.bodylen);
+    for(epicsUInt32 i=10u; i<200u; i++)
+        publish(W, i);
+    W.commit();
+
+    testOk(!intact(rec, rec.body), "record overwritten in place");
+    testOk1(!R.valid());
+    testOk1(R.overruns()==1u);
+    testOk1(R.lost()>0u);
+
+    // resync to the newest
+    testOk1(!R.next(rec));
+    for(epicsUInt32 i=200u; i<203u; i++)
+        publish(W, i);
+    W.commit();
+    epicsUInt32 n = 200u;
+    bool ok = true;
+    while(R.next(rec)) {
+        ok &= rec.nsec==n && intact(rec, rec.body) && R.valid();
+        n++;
+    }
+    testOk(ok && n==203u, "resync read through %u", unsigned(n));
+
+    // lapped between calls to next()
+    for(epicsUInt32 i=203u; i<400u; i++)
+        publish(W, i);
+    W.commit();
+    testOk1(!R.next(rec));
+    testOk1(R.overruns()==2u);
+    publish(W, 400u);
+    W.commit();
+    testOk1(R.next(rec) && rec.nsec==400u && intact(rec, rec.body) && R.valid());
+}
+
+// publish in bursts, for a reader in another thread
+struct Publisher : public epicsThreadRunable {
+    UDPShmWriter& W;
+    const epicsUInt32 count;
+    int done;
+    epicsEvent drained; // reader found no more records
+    epicsThread worker;
+
+    Publisher(UDPShmWriter& W, epicsUInt32 count)
+        :W(W), count(count), done(0)
+        ,worker(*this, "testshmw", epicsThreadGetStackSize(epicsThreadStackSmall), epicsThreadPriorityMedium)
+    {}
+    virtual ~Publisher() {}
+
+    virtual void run() override final
+    {
+        // bursts of 1 to 100 records.  Longer than 64 laps a reader which has fallen behind.
+        epicsUInt32 i = 0u;
+        for(epicsUInt32 burst=0u; i<count; burst++) {
+            for(epicsUInt32 n = 1u + (burst*37u)%100u; n && i<count; n--, i++) {
+                publish(W, i);
+                if(i%4u==3u)
+                    W.commit();
+            }
+            W.commit();
+            drained.wait();
+        }
+        epics::atomic::set(done, 1);
+    }
+};
+
+void testConcurrent()
+{
+    testDiag("Concurrent writer never gives torn records");
+    UDPShmWriter W(shmName(), 4096u);
+    UDPShmReader R(W.name());
+    UDPRecord rec;
+
+    const epicsUInt32 count = 100000u;
+    Publisher P(W, count);
+    P.worker.start();
+
+    size_t nread = 0u, ntorn = 0u, nbehind = 0u;
+    epicsUInt32 prev = 0u;
+    char copy[bodyLen];
+    while(true) {
+        const bool fin = epics::atomic::get(P.done);
+        while(R.next(rec)) {
+            const UDPRecord got(rec);
+            memcpy(copy, rec.body, bodyLen);
+            if(!R.valid())
+                continue;
+            if(!intact(got, copy))
+                ntorn++;
+            if(nread && got.nsec<=prev)
+                nbehind++;
+            prev = got.nsec;
+            nread++;
+        }
+        if(fin)
+            break;
+        P.drained.signal();
+    }
+    P.worker.exitWait();
+
+    testDiag("read %u of %u, overruns %u", unsigned(nread), unsigned(count), unsigned(R.overruns()));
+    testOk(nread>0u, "read %u", unsigned(nread));
+    testOk(ntorn==0u, "torn %u", unsigned(ntorn));
+    testOk(nbehind==0u, "out of order %u", unsigned(nbehind));
+
+    // the last may have been skipped by an overrun, but the reader is now at the head
+    publish(W, count);
+    W.commit();
+    testOk1(R.next(rec) && rec.nsec==count && R.valid());
+}
+
+} // namespace
+
+MAIN(testUDPShm)
+{
+    testPlan(23);
+    try {
+        testInOrder();
+        testOverrun();
+        testConcurrent();
+    } catch(std::exception& e) {
+        testAbort("Unexpected exception: %s", e.what());
+    }
+    return testDone();
+}
@@ -0,0 +1,49 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+/* UDPFast::stop() wakes a receiver blocked on a socket with a filter attached.
+ */
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include "udpdrv.h"
+
+namespace {
+
+void testStop()
+{
+    testDiag("Stop with PSCUDPSocketFilter (default on)");
+
+    // nothing will be sent from the peer, so rxfn() is blocked with SO_RCVTIMEO (1 second)
+    UDPFast *dev = new UDPFast("testudpstop", "127.0.0.1", 9u, 0u);
+    testOk1(dev->peers.size()==1u);
+    dev->connect();
+    epicsThreadSleep(0.1);
+
+    const epicsUInt64 start = epicsMonotonicGet();
+    dev->stop();
+    const double elapsed = double(epicsMonotonicGet() - start)*1e-9;
+
+    testOk(elapsed < 0.5, "stop() took %.3f s", elapsed);
+    testOk1(dev->ntimeout==0u);
+    delete dev;
+}
+
+} // namespace
+
+MAIN(testUDPStop)
+{
+    testPlan(3);
+    try {
+        testStop();
+    } catch(std::exception& e) {
+        testAbort("Unexpected exception: %s", e.what());
+    }
+    return testDone();
+}
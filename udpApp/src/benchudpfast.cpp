@@ -0,0 +1,348 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+/* Load generator and soak benchmark for UDPFast.
+ *
+ * Sends PSC framed packets with sendmmsg() at a fixed, or ramping, rate.
+ * Optionally reads the status PVs of a UDPFast instance (see pscudpfast.db)
+ * to report receive rate, drops, buffer occupancy, per-stage latency,
+ * and CPU time of the IOC process, once per interval.
+ *
+ * See iocBoot/iocudpsoak/
+ *
+ * benchudpfast [-r <pkt/s>] [-u <pkt/s>] [-s <bytes>] [-m <#msgid>] [-b <batch>]
+ *              [-t <sec>] [-i <sec>] [-l <port>] [-p <prefix>] [-c <pid>] <host:port>
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <cadef.h>
+
+#include "utilpvt.h"
+
+namespace {
+
+double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void putU16(char *buf, epicsUInt16 val) { buf[0] = char(val>>8u); buf[1] = char(val); }
+void putU32(char *buf, epicsUInt32 val) { putU16(buf, val>>16u); putU16(buf+2, val); }
+
+// status PVs of one UDPFast instance.  Read with CA
+struct Status {
+    enum {
+        NRX, NDrp, NooM, PFree, LatC, LatCMax, LatW, LatWMax, NPV
+    };
+    chid chans[NPV];
+    double vals[NPV];
+
+    explicit Status(const std::string& prefix)
+    {
+        static const char* const names[NPV] = {
+            "NRX-I", "NDrp-I", "NooM-I", "PFree-I", "LatC-I", "LatCMax-I", "LatW-I", "LatWMax-I",
+        };
+
+        if(ca_context_create(ca_disable_preemptive_callback)!=ECA_NORMAL)
+            throw std::runtime_error("Unable to create CA context");
+
+        for(size_t i=0; i<NPV; i++) {
+            vals[i] = 0.0;
+            std::string pv(prefix+names[i]);
+            if(ca_create_channel(pv.c_str(), 0, 0, CA_PRIORITY_DEFAULT, &chans[i])!=ECA_NORMAL)
+                throw std::runtime_error("Unable to create channel "+pv);
+        }
+        if(ca_pend_io(5.0)!=ECA_NORMAL)
+            throw std::runtime_error("Timeout connecting to "+prefix+"*");
+    }
+    ~Status() {
+        ca_context_destroy();
+    }
+
+    bool update() {
+        for(size_t i=0; i<NPV; i++)
+            (void)ca_get(DBR_DOUBLE, chans[i], &vals[i]);
+        return ca_pend_io(1.0)==ECA_NORMAL;
+    }
+};
+
+// total user+system CPU time (sec) of a process
+double cpuTime(pid_t pid)
+{
+    char fname[64];
+    snprintf(fname, sizeof(fname), "/proc/%d/stat", int(pid));
+    FILE *fp = fopen(fname, "r");
+    if(!fp)
+        return 0.0;
+
+    char line[1024];
+    unsigned long long utime = 0u, stime = 0u;
+    if(fgets(line, sizeof(line), fp)) {
+        // skip "pid (comm)" as comm may contain spaces
+        const char *pos = strrchr(line, ')');
+        if(pos)
+            (void)sscanf(pos+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime);
+    }
+    fclose(fp);
+    return (utime+stime)/double(sysconf(_SC_CLK_TCK));
+}
+
+int run(int argc, char *argv[])
+{
+    double rate = 100000.0; // pkt/s
+    double ramp = 0.0;      // pkt/s added each interval
+    unsigned bodylen = 1000u;
+    unsigned nmsgids = 4u;
+    unsigned batch = 64u;
+    double duration = 0.0;  // sec.  zero for until interrupted
+    double interval = 1.0;  // sec
+    unsigned short lport = 0u;
+    std::string prefix;
+    pid_t iocpid = 0;
+
+    {
+        int opt;
+        while((opt = getopt(argc, argv, "hr:u:s:m:b:t:i:l:p:c:")) != -1) {
+            switch(opt) {
+            case 'r': rate = strtod(optarg, 0); break;
+            case 'u': ramp = strtod(optarg, 0); break;
+            case 's': bodylen = strtoul(optarg, 0, 0); break;
+            case 'm': nmsgids = strtoul(optarg, 0, 0); break;
+            case 'b': batch = strtoul(optarg, 0, 0); break;
+            case 't': duration = strtod(optarg, 0); break;
+            case 'i': interval = strtod(optarg, 0); break;
+            case 'l': lport = strtoul(optarg, 0, 0); break;
+            case 'p': prefix = optarg; break;
+            case 'c': iocpid = strtol(optarg, 0, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-r <pkt/s>] [-u <pkt/s>] [-s <bytes>] [-m <#msgid>] [-b <batch>]\n"
+                                "          [-t <sec>] [-i <sec>] [-l <port>] [-p <prefix>] [-c <pid>] <host:port>\n"
+                                " -r  Packet rate.  Zero for as fast as possible\n"
+                                " -u  Increase rate by this much each interval\n"
+                                " -s  Body size in bytes (>=12)\n"
+                                " -m  Number of distinct msgids\n"
+                                " -b  Packets per sendmmsg() call\n"
+                                " -t  Run time.  Default is until interrupted\n"
+                                " -i  Report interval\n"
+                                " -l  Local (source) port.  Must match the port given to createPSCUDPFast()\n"
+                                " -p  PV prefix of a pscudpfast.db instance to report\n"
+                                " -c  PID of the IOC process, to report CPU time per packet\n", argv[0]);
+                return opt=='h' ? 0 : 1;
+            }
+        }
+    }
+    if(optind>=argc)
+        throw std::runtime_error("Missing destination <host:port>");
+    if(bodylen<12u || bodylen>65000u || !nmsgids || !batch || interval<=0.0)
+        throw std::runtime_error("Invalid size, msgid count, batch, or interval");
+
+    sockaddr_in dest;
+    {
+        std::string addr(argv[optind]);
+        size_t sep = addr.find_last_of(':');
+        if(sep==std::string::npos)
+            throw std::runtime_error("Destination must be <host:port>");
+
+        addrinfo hints, *res = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if(getaddrinfo(addr.substr(0, sep).c_str(), addr.substr(sep+1u).c_str(), &hints, &res) || !res)
+            throw std::runtime_error("Unable to resolve "+addr);
+        memcpy(&dest, res->ai_addr, sizeof(dest));
+        freeaddrinfo(res);
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+    if(sock<0)
+        throw std::runtime_error(std::string("socket() : ")+strerror(errno));
+    {
+        int sndbuf = 4u<<20u;
+        (void)setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+        sockaddr_in self;
+        memset(&self, 0, sizeof(self));
+        self.sin_family = AF_INET;
+        self.sin_addr.s_addr = htonl(INADDR_ANY);
+        self.sin_port = htons(lport);
+        if(bind(sock, (sockaddr*)&self, sizeof(self)))
+            throw std::runtime_error(std::string("bind() : ")+strerror(errno));
+    }
+
+    // one pre-formatted packet per batch slot.
+    // Body begins with a sequence number and send time (CLOCK_REALTIME).
+    std::vector<std::vector<char> > bufs(batch);
+    std::vector<iovec> iovs(batch);
+    std::vector<mmsghdr> hdrs(batch);
+    for(size_t i=0; i<batch; i++) {
+        bufs[i].resize(8u+bodylen);
+        char *P = &bufs[i][0];
+        P[0] = 'P';
+        P[1] = 'S';
+        putU32(P+4, bodylen);
+        memset(P+20, char(i), bodylen-12u);
+
+        iovs[i].iov_base = P;
+        iovs[i].iov_len = bufs[i].size();
+
+        memset(&hdrs[i], 0, sizeof(hdrs[i]));
+        hdrs[i].msg_hdr.msg_name = &dest;
+        hdrs[i].msg_hdr.msg_namelen = sizeof(dest);
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1u;
+    }
+
+    psc::auto_ptr<Status> status;
+    if(!prefix.empty())
+        status.reset(new Status(prefix));
+
+    printf("# %8s %10s %10s %8s %8s %6s %8s %8s %8s %8s %8s\n",
+           "time", "tx/s", "rx/s", "drop/s", "noom", "free%",
+           "cache ms", "max", "write ms", "max", "cpu us/p");
+
+    epicsUInt32 seq = 0u;
+    epicsUInt64 sent = 0u, nerr = 0u;
+    const double start = now();
+    double rateStart = start;   // time, and count sent, when rate last changed
+    epicsUInt64 rateSent = 0u;
+    double nextReport = start + interval;
+
+    double prevT = start;
+    epicsUInt64 prevSent = 0u;
+    double prevRX = 0.0, prevDrp = 0.0, prevOOM = 0.0, prevCPU = iocpid ? cpuTime(iocpid) : 0.0;
+    bool first = true;
+    double lastClean = 0.0; // highest rate without new drops or OOM
+    bool dropping = false;
+
+    while(!duration || now()-start < duration) {
+        double T = now();
+
+        // number of packets due to be sent by now
+        size_t n = batch;
+        if(rate>0.0) {
+            double due = rate*(T-rateStart) - double(sent-rateSent);
+            if(due<1.0) {
+                timespec delay = {0, long(std::min(1.0, (1.0-due)/rate)*1e9)};
+                (void)nanosleep(&delay, 0);
+                n = 0u;
+            } else if(due<n) {
+                n = size_t(due);
+            }
+        }
+
+        if(n) {
+            timespec wall;
+            clock_gettime(CLOCK_REALTIME, &wall);
+            for(size_t i=0; i<n; i++) {
+                char *P = &bufs[i][0];
+                putU16(P+2, epicsUInt16(seq%nmsgids));
+                putU32(P+8, seq);
+                putU32(P+12, epicsUInt32(wall.tv_sec));
+                putU32(P+16, epicsUInt32(wall.tv_nsec));
+                seq++;
+            }
+            int ret = sendmmsg(sock, &hdrs[0], n, 0);
+            if(ret<0) {
+                if(errno!=EAGAIN && errno!=ENOBUFS && errno!=EINTR)
+                    throw std::runtime_error(std::string("sendmmsg() : ")+strerror(errno));
+                nerr++;
+                seq -= n;
+            } else {
+                sent += ret;
+                seq -= n - size_t(ret);
+            }
+        }
+
+        if(T < nextReport)
+            continue;
+        nextReport += interval;
+
+        double dT = T - prevT;
+        double txrate = (sent-prevSent)/dT;
+        double rxrate = 0.0, drprate = 0.0, cpup = 0.0;
+        double *V = status.get() ? status->vals : 0;
+        bool ok = status.get() && status->update();
+
+        if(ok) {
+            rxrate = first ? 0.0 : (V[Status::NRX]-prevRX)/dT;
+            drprate = first ? 0.0 : (V[Status::NDrp]-prevDrp)/dT;
+            if(!first && (drprate>0.0 || V[Status::NooM]>prevOOM))
+                dropping = true;
+            prevRX = V[Status::NRX];
+            prevDrp = V[Status::NDrp];
+            prevOOM = V[Status::NooM];
+        }
+        if(iocpid) {
+            double cpu = cpuTime(iocpid);
+            if(sent>prevSent)
+                cpup = (cpu-prevCPU)/(sent-prevSent)*1e6;
+            prevCPU = cpu;
+        }
+        if(ok) {
+            printf("  %8.1f %10.0f %10.0f %8.0f %8.0f %6.1f %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+                   T-start, txrate, rxrate, drprate, V[Status::NooM], V[Status::PFree],
+                   V[Status::LatC], V[Status::LatCMax], V[Status::LatW], V[Status::LatWMax], cpup);
+        } else {
+            printf("  %8.1f %10.0f %10s %8s %8s %6s %8s %8s %8s %8s %8.3f\n",
+                   T-start, txrate, "-", "-", "-", "-", "-", "-", "-", "-", cpup);
+        }
+        fflush(stdout);
+
+        if(!dropping && !first)
+            lastClean = txrate;
+        first = false;
+        prevT = T;
+        prevSent = sent;
+
+        if(ramp>0.0 && rate>0.0) {
+            rate += ramp;
+            rateStart = T;
+            rateSent = sent;
+        }
+    }
+
+    printf("# sent %llu packets in %.1f sec.  %llu sendmmsg() errors\n",
+           (unsigned long long)sent, now()-start, (unsigned long long)nerr);
+    if(status.get()) {
+        if(dropping)
+            printf("# first drops or OOM above %.0f pkt/s\n", lastClean);
+        else
+            printf("# no drops or OOM\n");
+    }
+
+    close(sock);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    try {
+        return run(argc, argv);
+    }catch(std::exception& e){
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
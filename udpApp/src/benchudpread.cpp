@@ -0,0 +1,258 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+/* Throughput benchmark of the .dat reader.
+ *
+ * Generates a synthetic recording, split into several "rotated" files,
+ * then times several passes over it.
+ *
+ * benchudpread [-s <MB>] [-n <files>] [-c] [-k] [<prefix>]
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+
+#include "udpreader.h"
+
+namespace {
+
+const unsigned nmsgids = 16u;
+
+double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void putU16(char *buf, epicsUInt16 val) { buf[0] = char(val>>8u); buf[1] = char(val); }
+void putU32(char *buf, epicsUInt32 val) { putU16(buf, val>>16u); putU16(buf+2, val); }
+
+// write 'size' bytes of records, continuing the time sequence from 'T' (ns)
+void generate(const std::string& fname, epicsUInt64 size, epicsUInt64& T, epicsUInt32& seq)
+{
+    int fd = open(fname.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if(fd<0)
+        throw std::runtime_error("open "+fname+" : "+strerror(errno));
+
+    std::vector<char> buf(1u<<20u);
+    epicsUInt64 total = 0u;
+    while(total < size) {
+        size_t fill = 0u;
+        while(true) {
+            // message sizes typical of PSC devices
+            epicsUInt16 msgid = seq%nmsgids;
+            epicsUInt32 bodylen = 200u + 80u*msgid;
+            if(fill + 16u + bodylen > buf.size())
+                break;
+
+            char *H = &buf[fill];
+            H[0] = 'P';
+            H[1] = 'S';
+            putU16(H+2, msgid);
+            putU32(H+4, bodylen);
+            putU32(H+8, epicsUInt32(T/1000000000u));
+            putU32(H+12, epicsUInt32(T%1000000000u));
+            // body begins with a sequence number
+            putU32(H+16, seq);
+            memset(H+20, char(seq), bodylen-4u);
+
+            fill += 16u + bodylen;
+            seq++;
+            T += 4000u; // 250k packets per second
+        }
+        if(write(fd, &buf[0], fill)!=ssize_t(fill))
+            throw std::runtime_error("write "+fname+" : "+strerror(errno));
+        total += fill;
+    }
+
+    if(fdatasync(fd))
+        throw std::runtime_error("fdatasync "+fname+" : "+strerror(errno));
+    close(fd);
+}
+
+void dropCache(const std::vector<std::string>& fnames)
+{
+    for(size_t i=0; i<fnames.size(); i++) {
+        int fd = open(fnames[i].c_str(), O_RDONLY|O_CLOEXEC);
+        if(fd>=0) {
+            (void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+struct Pass {
+    size_t nrec;
+    epicsUInt64 nbytes; // of data file scanned
+    epicsUInt64 check;
+    double sec;
+};
+
+void report(const char *name, const Pass& P)
+{
+    printf("%-24s %10zu records %8.1f MB/s %8.2f Mrec/s  (check %llx)\n", name, P.nrec,
+           P.nbytes/P.sec/(1u<<20u), P.nrec/P.sec/1e6, (unsigned long long)P.check);
+}
+
+int run(int argc, char *argv[])
+{
+    epicsUInt64 sizeMB = 4096u;
+    unsigned nfiles = 4u;
+    bool cold = false, keep = false;
+
+    {
+        int opt;
+        while((opt = getopt(argc, argv, "hs:n:ck")) != -1) {
+            switch(opt) {
+            case 's': sizeMB = strtoull(optarg, 0, 0); break;
+            case 'n': nfiles = strtoul(optarg, 0, 0); break;
+            case 'c': cold = true; break;
+            case 'k': keep = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s <total MB>] [-n <#files>] [-c] [-k] [<prefix>]\n"
+                                " -c  Drop page cache before each pass\n"
+                                " -k  Keep generated files\n", argv[0]);
+                return opt=='h' ? 0 : 1;
+            }
+        }
+    }
+    if(!sizeMB || !nfiles)
+        throw std::runtime_error("Size and file count must be non-zero");
+
+    std::string prefix(optind<argc ? argv[optind] : "benchudpread-");
+
+    std::vector<std::string> fnames;
+    {
+        epicsUInt64 T = epicsUInt64(1617248700u)*1000000000u;
+        epicsUInt32 seq = 0u;
+        double start = now();
+        for(unsigned i=0; i<nfiles; i++) {
+            std::ostringstream strm;
+            strm<<prefix<<i<<".dat";
+            fnames.push_back(strm.str());
+            generate(fnames.back(), (sizeMB<<20u)/nfiles, T, seq);
+        }
+        double sec = now()-start;
+        printf("Generated %u files, %llu MB, %u records in %.1f sec\n", nfiles, (unsigned long long)sizeMB,
+               unsigned(seq), sec);
+    }
+
+    epicsUInt64 totalsize = 0u;
+    {
+        UDPFilter all;
+        UDPMergeReader reader(all);
+        for(size_t i=0; i<fnames.size(); i++)
+            reader.add(fnames[i]);
+        for(size_t i=0; i<reader.nfiles(); i++)
+            totalsize += reader.file(i).size();
+    }
+
+    // each file in turn, touching every body
+    {
+        if(cold)
+            dropCache(fnames);
+        Pass P = {0u, totalsize, 0u, 0.0};
+        UDPFilter all;
+        double start = now();
+        for(size_t i=0; i<fnames.size(); i++) {
+            UDPDataFile file(fnames[i]);
+            UDPFileReader reader(file, all);
+            UDPRecord rec;
+            while(reader.next(rec)) {
+                P.nrec++;
+                P.check += epicsUInt8(rec.body[rec.bodylen-1u]);
+            }
+        }
+        P.sec = now()-start;
+        report("sequential", P);
+    }
+
+    // k-way merge of all files, extracting a column from each body
+    {
+        if(cold)
+            dropCache(fnames);
+        Pass P = {0u, totalsize, 0u, 0.0};
+        UDPFilter all;
+        UDPMergeReader reader(all);
+        for(size_t i=0; i<fnames.size(); i++)
+            reader.add(fnames[i]);
+
+        std::vector<epicsUInt32> column;
+        column.reserve(1u<<20u);
+
+        double start = now();
+        UDPRecord rec;
+        epicsUInt64 prev = 0u;
+        while(reader.next(rec)) {
+            if(rec.time()<prev)
+                throw std::logic_error("merge out of order");
+            prev = rec.time();
+            const epicsUInt8 *B = reinterpret_cast<const epicsUInt8*>(rec.body);
+            column.push_back((epicsUInt32(B[0])<<24u) | (epicsUInt32(B[1])<<16u) | (epicsUInt32(B[2])<<8u) | B[3]);
+            if(column.size()==column.capacity()) {
+                P.check += column.back();
+                column.clear();
+            }
+            P.nrec++;
+        }
+        P.sec = now()-start;
+        report("merge + column", P);
+    }
+
+    // select one msgid
+    {
+        if(cold)
+            dropCache(fnames);
+        Pass P = {0u, totalsize, 0u, 0.0};
+        UDPFilter one;
+        one.allow(3u);
+        UDPMergeReader reader(one);
+        for(size_t i=0; i<fnames.size(); i++)
+            reader.add(fnames[i]);
+
+        double start = now();
+        UDPRecord rec;
+        while(reader.next(rec)) {
+            P.nrec++;
+            P.check += epicsUInt8(rec.body[3]);
+        }
+        P.sec = now()-start;
+        report("merge + msgid filter", P);
+    }
+
+    if(!keep) {
+        for(size_t i=0; i<fnames.size(); i++)
+            unlink(fnames[i].c_str());
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    try {
+        return run(argc, argv);
+    } catch(std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
@@ -13,6 +13,7 @@
 #include <boRecord.h>
 #include <biRecord.h>
 #include <aiRecord.h>
+#include <aoRecord.h>
 #include <longinRecord.h>
 #include <int64inRecord.h>
 #include <aaiRecord.h>
@@ -97,6 +98,17 @@ long devudp_set_string(lsoRecord* prec)
     }CATCH(devudp_set_string, prec);
 }
 
+long devudp_set_policy(lsoRecord* prec)
+{
+    TRY {
+        prec->val[prec->sizv - 1u] = '\0'; // paranoia
+        // empty (eg. PINI without autosave) leaves any policy set from iocsh
+        if(prec->val[0])
+            dev->setRecordPolicy(prec->val, true);
+        return 0;
+    }CATCH(devudp_set_policy, prec);
+}
+
 long devudp_reopen(boRecord* prec)
 {
     TRY {
@@ -123,6 +135,52 @@ long devudp_set_record(boRecord* prec)
     }CATCH(devudp_set_record, prec);
 }
 
+template<bool UDPFast::*FLAG>
+long devudp_set_flag(boRecord* prec)
+{
+    TRY {
+        {
+            Guard G(dev->lock);
+            dev->*FLAG = prec->val;
+        }
+        dev->pendingReady.signal();
+        return 0;
+    }CATCH(devudp_set_flag, prec);
+}
+
+template<bool UDPFast::*FLAG>
+long devudp_get_flag(biRecord* prec)
+{
+    TRY {
+        Guard G(dev->lock);
+        prec->rval = dev->*FLAG;
+        return 0;
+    }CATCH(devudp_get_flag, prec);
+}
+
+template<double UDPFast::*VAL>
+long devudp_set_double(aoRecord* prec)
+{
+    TRY {
+        Guard G(dev->lock);
+        dev->*VAL = prec->val;
+        return 0;
+    }CATCH(devudp_set_double, prec);
+}
+
+long devudp_trigger(boRecord* prec)
+{
+    TRY {
+        {
+            Guard G(dev->lock);
+            dev->trigPending = true;
+            epicsTimeGetCurrent(&dev->trigTime);
+        }
+        dev->pendingReady.signal();
+        return 0;
+    }CATCH(devudp_trigger, prec);
+}
+
 long devudp_get_record(biRecord* prec)
 {
     TRY {
@@ -158,7 +216,7 @@ long devudp_get_vpool(aiRecord* prec)
         double val;
         {
             Guard G(dev->lock);
-            val = dev->vpool.size()/double(dev->vpoolTotal);
+            val = dev->vpool.size()/double(epicsAtomicGetSizeT(&dev->vpoolTotal));
         }
         prec->val = analogRaw2EGU<double>(prec, val);
         return 2;
@@ -171,7 +229,7 @@ long devudp_get_pending(aiRecord* prec)
         double val;
         {
             Guard G(dev->lock);
-            val = dev->pending.size()/double(dev->vpoolTotal);
+            val = dev->pending.size()/double(epicsAtomicGetSizeT(&dev->vpoolTotal));
         }
         prec->val = analogRaw2EGU<double>(prec, val);
         return 2;
@@ -184,7 +242,7 @@ long devudp_get_inprog(aiRecord* prec)
         double val;
         {
             Guard G(dev->lock);
-            epicsInt64 total = dev->vpoolTotal,
+            epicsInt64 total = epicsAtomicGetSizeT(&dev->vpoolTotal),
                        inuse = dev->vpool.size() + dev->pending.size();
             val = (total-inuse)/double(total);
         }
@@ -193,6 +251,39 @@ long devudp_get_inprog(aiRecord* prec)
     }CATCH(devudp_get_inprog, prec);
 }
 
+// packet buffer pool size (MB)
+long devudp_get_poolsize(aiRecord* prec)
+{
+    TRY {
+        double val = epicsAtomicGetSizeT(&dev->vpoolTotal)*double(dev->vpoolBufSize)/(1u<<20u);
+        prec->val = analogRaw2EGU<double>(prec, val);
+        return 2;
+    }CATCH(devudp_get_poolsize, prec);
+}
+
+// mean or max latency (ms) since the previous read
+template<UDPFast::Latency UDPFast::*LAT, bool MAX>
+long devudp_get_latency(aiRecord* prec)
+{
+    TRY {
+        double val;
+        {
+            Guard G(dev->lock);
+            UDPFast::Latency& lat = dev->*LAT;
+            if(MAX) {
+                val = lat.max;
+                lat.max = 0.0;
+            } else {
+                val = lat.count ? lat.sum/lat.count : 0.0;
+                lat.sum = 0.0;
+                lat.count = 0u;
+            }
+        }
+        prec->val = analogRaw2EGU<double>(prec, val*1e3);
+        return 2;
+    }CATCH(devudp_get_latency, prec);
+}
+
 template<size_t UDPFast::*CNT>
 long devudp_get_counter(int64inRecord *prec)
 {
@@ -210,8 +301,82 @@ long devudp_get_lastsize(int64inRecord* prec)
     }CATCH(devudp_get_lastsize, prec);
 }
 
+// cumulative histogram, eg. of packets per recvmmsg() call
+template<size_t N, size_t (UDPFast::*HIST)[N]>
+long devudp_read_hist(aaiRecord* prec)
+{
+    if(prec->ftvl!=menuFtypeDOUBLE) {
+        (void)recGblSetSevr(prec, STATE_ALARM, INVALID_ALARM);
+        return 0;
+    }
+
+    TRY {
+        size_t count = std::min(size_t(prec->nelm), N);
+        double* arr = static_cast<double*>(prec->bptr);
+
+        for(size_t i=0; i<count; i++)
+            arr[i] = epicsAtomicGetSizeT(&(dev->*HIST)[i]);
+
+        prec->nord = epicsUInt32(count);
+        return 0;
+    }CATCH(devudp_read_hist, prec);
+}
+
+struct privPeer {
+    UDPFast *psc;
+    size_t index; // in UDPFast::peers
+};
+
+// INP "@instance label"
+long devudp_init_record_peer(int64inRecord *prec)
+{
+    try {
+        const char *link = prec->inp.value.instio.string;
+        std::istringstream strm(link);
+        std::string name, label;
+
+        strm >> name >> label;
+
+        if(strm.fail()) {
+            timefprintf(stderr, "%s: Error Parsing: '%s'\n",
+                    prec->name, link);
+            throw std::runtime_error("Link parsing error");
+        }
+
+        psc::auto_ptr<privPeer> priv(new privPeer);
+        priv->psc = PSC::getPSC<UDPFast>(name);
+
+        const UDPFast::peers_t& peers = priv->psc->peers;
+        for(priv->index=0u; priv->index<peers.size(); priv->index++) {
+            if(peers[priv->index].label==label)
+                break;
+        }
+        if(priv->index==peers.size()) {
+            timefprintf(stderr, "%s: UDPFast '%s' has no peer '%s'\n",
+                    prec->name, name.c_str(), label.c_str());
+            throw std::runtime_error("Unknown peer");
+        }
+
+        prec->dpvt = (void*)priv.release();
+        return 0;
+
+    }CATCH(devudp_init_record_peer, prec);
+}
+
+template<size_t UDPFast::Peer::*CNT>
+long devudp_get_peer_counter(int64inRecord* prec)
+{
+    if(!prec->dpvt) return -1;
+    privPeer *priv = (privPeer*)prec->dpvt;
+    try {
+        prec->val = epicsAtomicGetSizeT(&(priv->psc->peers[priv->index].*CNT));
+        return 0;
+    }CATCH(devudp_get_peer_counter, prec);
+}
+
 struct privShortBuf {
     UDPFast *psc;
+    UDPFast::ShortRing *ring;
     unsigned int block;
     unsigned long offset;
 };
@@ -219,20 +384,24 @@ struct privShortBuf {
 long devudp_clear_shortbuf(longinRecord *prec)
 {
     TRY {
-        UDPFast::pkts_t temp;
+        size_t count = 0u;
         {
+            // cachefn() returns cleared buffers to vpool
             Guard S(dev->shortLock);
-            temp.swap(dev->shortBuf);
-        }
-        {
-            Guard G(dev->rxLock);
-            for(size_t i=0u, N=temp.size(); i<N; i++) {
-                dev->vpool.push_back(UDPFast::vecs_t::value_type());
-                dev->vpool.back().swap(temp[i].body);
-                assert(!dev->vpool.back().empty());
+            for(UDPFast::shortrings_t::iterator it(dev->shortRings.begin()), end(dev->shortRings.end()); it!=end; ++it) {
+                UDPFast::pkts_t& pkts = it->second.pkts;
+                for(size_t i=0u, N=pkts.size(); i<N; i++) {
+                    dev->shortFree.push_back(UDPFast::pkt());
+                    dev->shortFree.back().swap(pkts[i]);
+                }
+                count += pkts.size();
+                pkts.clear(); // keeps capacity
             }
+            dev->shortRoom += count;
         }
-        prec->val += (epicsInt32)temp.size();
+        if(count)
+            dev->pendingReady.signal();
+        prec->val += (epicsInt32)count;
         return 0;
 
     }CATCH(devudp_clear_shortbuf, prec);
@@ -255,7 +424,7 @@ long devudp_init_record_shortbuf(R* prec)
         if(!strm.eof())
             strm >> offset;
 
-        if(strm.fail()) {
+        if(strm.fail() || block>0xffff) {
             timefprintf(stderr, "%s: Error Parsing: '%s'\n",
                     prec->name, link);
             throw std::runtime_error("Link parsing error");
@@ -269,19 +438,47 @@ long devudp_init_record_shortbuf(R* prec)
         priv->block = block;
         priv->offset = offset;
 
+        {
+            // buffer depth is the largest NELM
+            Guard S(priv->psc->shortLock);
+            UDPFast::ShortRing& ring = priv->psc->shortRings[block];
+            if(ring.limit < prec->nelm) {
+                priv->psc->shortRoom += prec->nelm - ring.limit;
+                ring.limit = prec->nelm;
+                ring.pkts.reserve(ring.limit);
+            }
+            priv->ring = &ring; // std::map entries are not moved
+            if(priv->psc->shortIndex.empty())
+                priv->psc->shortIndex.resize(0x10000u, 0);
+            priv->psc->shortIndex[block] = &ring;
+        }
+
         prec->dpvt = (void*)priv.release();
         return 0;
 
     }CATCH(devudp_init_record_shortbuf, prec);
 }
 
-long devudp_read_shortbuf(aaiRecord* prec)
+// extract one big endian value from each packet
+template<typename T>
+bool devudp_extract_short(aaiRecord* prec, const UDPFast::pkts_t& pkts, size_t N, unsigned long offset)
 {
-    if(prec->ftvl!=menuFtypeULONG) {
-        (void)recGblSetSevr(prec, STATE_ALARM, INVALID_ALARM);
-        return 0;
+    T* arr = static_cast<T*>(prec->bptr);
+    bool ok = true;
+    for(size_t i=0; i<N; i++) {
+        const UDPFast::pkt& pkt = pkts[i];
+        if(offset + sizeof(T) > pkt.bodylen) {
+            arr[i] = 0;
+            ok = false;
+        } else {
+            arr[i] = bytes2val<T>(&pkt.body[offset]);
+        }
     }
+    return ok;
+}
 
+long devudp_read_shortbuf(aaiRecord* prec)
+{
     TRY {
         Guard S(priv->psc->shortLock);
 
@@ -289,33 +486,26 @@ long devudp_read_shortbuf(aaiRecord* prec)
             (void)recGblSetSevr(prec, READ_ALARM, INVALID_ALARM);
         }
 
-        if(priv->psc->shortLimit < prec->nelm) {
-            // automatically expand
-            priv->psc->shortLimit = prec->nelm;
+        const UDPFast::pkts_t& pkts = priv->ring->pkts;
+        const size_t N = std::min(size_t(prec->nelm), pkts.size());
+        bool ok;
+
+        switch(prec->ftvl) {
+        case menuFtypeSHORT:  ok = devudp_extract_short<epicsInt16>(prec, pkts, N, priv->offset); break;
+        case menuFtypeUSHORT: ok = devudp_extract_short<epicsUInt16>(prec, pkts, N, priv->offset); break;
+        case menuFtypeLONG:   ok = devudp_extract_short<epicsInt32>(prec, pkts, N, priv->offset); break;
+        case menuFtypeULONG:  ok = devudp_extract_short<epicsUInt32>(prec, pkts, N, priv->offset); break;
+        case menuFtypeFLOAT:  ok = devudp_extract_short<epicsFloat32>(prec, pkts, N, priv->offset); break;
+        case menuFtypeDOUBLE: ok = devudp_extract_short<epicsFloat64>(prec, pkts, N, priv->offset); break;
+        default:
+            (void)recGblSetSevr(prec, STATE_ALARM, INVALID_ALARM);
+            return 0;
         }
+        if(!ok)
+            (void)recGblSetSevr(prec, READ_ALARM, INVALID_ALARM);
 
-        size_t N = std::min(size_t(prec->nelm), priv->psc->shortBuf.size());
-        epicsUInt32* arr = static_cast<epicsUInt32*>(prec->bptr);
-
-        for(size_t i=0; i<N; i++) {
-            const UDPFast::pkt& pkt = priv->psc->shortBuf[i];
-            if(pkt.msgid != priv->block)
-                continue;
-
-            if(i==0u && prec->tse==epicsTimeEventDeviceTime)
-                prec->time = pkt.rxtime;
-
-            epicsUInt32 rval = 0u;
-
-            if(priv->offset + 4u > pkt.body.size()) {
-                (void)recGblSetSevr(prec, READ_ALARM, INVALID_ALARM);
-
-            } else {
-                memcpy(&rval, &pkt.body[priv->offset], 4u);
-            }
-
-            arr[i] = ntohl(rval);
-        }
+        if(N && prec->tse==epicsTimeEventDeviceTime)
+            prec->time = pkts[0].rxtime;
 
         prec->nord = epicsUInt32(N);
         return 0;
@@ -328,14 +518,28 @@ long devudp_read_shortbuf(aaiRecord* prec)
 MAKEDSET(ai, devPSCUDPIntervalAI, &devudp_init_record_period, 0, &devudp_interval);
 MAKEDSET(lso, devPSCUDPFilebaseLSO, &devudp_init_record_out, 0, &devudp_set_string<&UDPFast::filebase>);
 MAKEDSET(lso, devPSCUDPFiledirLSO, &devudp_init_record_out, 0, &devudp_set_string<&UDPFast::filedir>);
+MAKEDSET(lso, devPSCUDPPolicyLSO, &devudp_init_record_out, 0, &devudp_set_policy);
 MAKEDSET(bo, devPSCUDPReopenBO, &devudp_init_record_out, 0, &devudp_reopen);
 MAKEDSET(bo, devPSCUDPRecordBO, &devudp_init_record_out, 0, &devudp_set_record);
 MAKEDSET(bi, devPSCUDPRecordBI, &devudp_init_record_in, 0, &devudp_get_record);
+MAKEDSET(bo, devPSCUDPTrigModeBO, &devudp_init_record_out, 0, &devudp_set_flag<&UDPFast::trigMode>);
+MAKEDSET(ao, devPSCUDPTrigPreAO, &devudp_init_record_out, 0, &devudp_set_double<&UDPFast::trigPre>);
+MAKEDSET(ao, devPSCUDPTrigPostAO, &devudp_init_record_out, 0, &devudp_set_double<&UDPFast::trigPost>);
+MAKEDSET(bo, devPSCUDPTriggerBO, &devudp_init_record_out, 0, &devudp_trigger);
+MAKEDSET(bi, devPSCUDPCapturingBI, &devudp_init_record_in, 0, &devudp_get_flag<&UDPFast::capturing>);
+MAKEDSET(int64in, devPSCUDPntrigI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::ntrig>);
+MAKEDSET(int64in, devPSCUDPnfiltI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::nfiltered>);
 MAKEDSET(lsi, devPSCUDPFilenameLSI, &devudp_init_record_in, 0, &devudp_get_string<&UDPFast::lastfile>);
 MAKEDSET(lsi, devPSCUDPErrorLSI, &devudp_init_record_in, 0, &devudp_get_string<&UDPFast::lasterror>);
 MAKEDSET(ai, devPSCUDPvpoolAI, &devudp_init_record_in, 0, &devudp_get_vpool);
 MAKEDSET(ai, devPSCUDPpendingAI, &devudp_init_record_in, 0, &devudp_get_pending);
 MAKEDSET(ai, devPSCUDPinprogAI, &devudp_init_record_in, 0, &devudp_get_inprog);
+MAKEDSET(ai, devPSCUDPlatCacheAI, &devudp_init_record_in, 0, (&devudp_get_latency<&UDPFast::latCache, false>));
+MAKEDSET(ai, devPSCUDPlatCacheMaxAI, &devudp_init_record_in, 0, (&devudp_get_latency<&UDPFast::latCache, true>));
+MAKEDSET(ai, devPSCUDPlatWriteAI, &devudp_init_record_in, 0, (&devudp_get_latency<&UDPFast::latWrite, false>));
+MAKEDSET(ai, devPSCUDPlatWriteMaxAI, &devudp_init_record_in, 0, (&devudp_get_latency<&UDPFast::latWrite, true>));
+MAKEDSET(ai, devPSCUDPlatRxAI, &devudp_init_record_in, 0, (&devudp_get_latency<&UDPFast::latRx, false>));
+MAKEDSET(ai, devPSCUDPlatRxMaxAI, &devudp_init_record_in, 0, (&devudp_get_latency<&UDPFast::latRx, true>));
 MAKEDSET(int64in, devPSCUDPnetrxI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::netrx>);
 MAKEDSET(int64in, devPSCUDPwroteI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::storewrote>);
 MAKEDSET(int64in, devPSCUDPndropI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::ndrops>);
@@ -344,6 +548,19 @@ MAKEDSET(int64in, devPSCUDPlastsizeI64I, &devudp_init_record_in, 0, &devudp_get_
 MAKEDSET(int64in, devPSCUDPnrxI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::rxcnt>);
 MAKEDSET(int64in, devPSCUDPntimeoutI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::ntimeout>);
 MAKEDSET(int64in, devPSCUDPnoomI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::noom>);
+MAKEDSET(ai, devPSCUDPpoolSizeAI, &devudp_init_record_in, 0, &devudp_get_poolsize);
+MAKEDSET(int64in, devPSCUDPngrowI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::ngrow>);
+MAKEDSET(int64in, devPSCUDPnshrinkI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::nshrink>);
+MAKEDSET(int64in, devPSCUDPcompinI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::compin>);
+MAKEDSET(int64in, devPSCUDPcompoutI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::compout>);
+MAKEDSET(int64in, devPSCUDPntxI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::ntx>);
+MAKEDSET(int64in, devPSCUDPntxerrI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::ntxerr>);
+MAKEDSET(int64in, devPSCUDPngroI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::ngro>);
+MAKEDSET(int64in, devPSCUDPbatchI64I, &devudp_init_record_in, 0, &devudp_get_counter<&UDPFast::batchActive>);
+MAKEDSET(aai, devPSCUDPbatchHistAAI, &devudp_init_record_in, 0, (&devudp_read_hist<UDPFast::batchHistSize, &UDPFast::batchHist>));
+MAKEDSET(aai, devPSCUDPrxLatHistAAI, &devudp_init_record_in, 0, (&devudp_read_hist<UDPFast::rxLatHistSize, &UDPFast::rxLatHist>));
+MAKEDSET(int64in, devPSCUDPpeerRxI64I, &devudp_init_record_peer, 0, &devudp_get_peer_counter<&UDPFast::Peer::nrx>);
+MAKEDSET(int64in, devPSCUDPpeerBytesI64I, &devudp_init_record_peer, 0, &devudp_get_peer_counter<&UDPFast::Peer::nbytes>);
 MAKEDSET(longin, devPSCUDPShortClearLI, &devudp_init_record_in, 0, &devudp_clear_shortbuf);
 MAKEDSET(aai, devPSCUDPShortGetAAI, &devudp_init_record_shortbuf, 0, &devudp_read_shortbuf);
 
@@ -353,14 +570,28 @@ extern "C" {
 epicsExportAddress(dset, devPSCUDPIntervalAI);
 epicsExportAddress(dset, devPSCUDPFilebaseLSO);
 epicsExportAddress(dset, devPSCUDPFiledirLSO);
+epicsExportAddress(dset, devPSCUDPPolicyLSO);
 epicsExportAddress(dset, devPSCUDPReopenBO);
 epicsExportAddress(dset, devPSCUDPRecordBO);
 epicsExportAddress(dset, devPSCUDPRecordBI);
+epicsExportAddress(dset, devPSCUDPTrigModeBO);
+epicsExportAddress(dset, devPSCUDPTrigPreAO);
+epicsExportAddress(dset, devPSCUDPTrigPostAO);
+epicsExportAddress(dset, devPSCUDPTriggerBO);
+epicsExportAddress(dset, devPSCUDPCapturingBI);
+epicsExportAddress(dset, devPSCUDPntrigI64I);
+epicsExportAddress(dset, devPSCUDPnfiltI64I);
 epicsExportAddress(dset, devPSCUDPFilenameLSI);
 epicsExportAddress(dset, devPSCUDPErrorLSI);
 epicsExportAddress(dset, devPSCUDPvpoolAI);
 epicsExportAddress(dset, devPSCUDPpendingAI);
 epicsExportAddress(dset, devPSCUDPinprogAI);
+epicsExportAddress(dset, devPSCUDPlatCacheAI);
+epicsExportAddress(dset, devPSCUDPlatCacheMaxAI);
+epicsExportAddress(dset, devPSCUDPlatWriteAI);
+epicsExportAddress(dset, devPSCUDPlatWriteMaxAI);
+epicsExportAddress(dset, devPSCUDPlatRxAI);
+epicsExportAddress(dset, devPSCUDPlatRxMaxAI);
 epicsExportAddress(dset, devPSCUDPnetrxI64I);
 epicsExportAddress(dset, devPSCUDPwroteI64I);
 epicsExportAddress(dset, devPSCUDPndropI64I);
@@ -369,6 +600,19 @@ epicsExportAddress(dset, devPSCUDPlastsizeI64I);
 epicsExportAddress(dset, devPSCUDPnrxI64I);
 epicsExportAddress(dset, devPSCUDPntimeoutI64I);
 epicsExportAddress(dset, devPSCUDPnoomI64I);
+epicsExportAddress(dset, devPSCUDPpoolSizeAI);
+epicsExportAddress(dset, devPSCUDPngrowI64I);
+epicsExportAddress(dset, devPSCUDPnshrinkI64I);
+epicsExportAddress(dset, devPSCUDPcompinI64I);
+epicsExportAddress(dset, devPSCUDPcompoutI64I);
+epicsExportAddress(dset, devPSCUDPntxI64I);
+epicsExportAddress(dset, devPSCUDPntxerrI64I);
+epicsExportAddress(dset, devPSCUDPngroI64I);
+epicsExportAddress(dset, devPSCUDPbatchI64I);
+epicsExportAddress(dset, devPSCUDPbatchHistAAI);
+epicsExportAddress(dset, devPSCUDPrxLatHistAAI);
+epicsExportAddress(dset, devPSCUDPpeerRxI64I);
+epicsExportAddress(dset, devPSCUDPpeerBytesI64I);
 epicsExportAddress(dset, devPSCUDPShortClearLI);
 epicsExportAddress(dset, devPSCUDPShortGetAAI);
 }
@@ -0,0 +1,400 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+/* Command line access to .dat files recorded by PSCUDPFast.
+ *
+ * pscudpread [-m <msgid>[,...]] [-b <time>] [-e <time>] [-r <sec>] [-l] [-o <column>=<file>] <file.dat> ...
+ * pscudpread [-m <msgid>[,...]] [-l] [-o <column>=<file>] -s </shmname>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+
+#include "udpreader.h"
+#include "udpshm.h"
+
+namespace {
+
+void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-h] [-m <msgid>[,...]] [-b <time>] [-e <time>] [-r <sec>] [-l] [-o <column>=<file>] <file.dat> ...\n"
+                    "       %s [-h] [-m <msgid>[,...]] [-l] [-o <column>=<file>] -s </shmname>\n"
+                    "\n"
+                    "Read records from one or more PSCUDPFast .dat files, merged by reception time.\n"
+                    "Or follow live records from shared memory (see setPSCUDPFastShm()) until interrupted.\n"
+                    "By default, a summary of records per message ID is printed.\n"
+                    "\n"
+                    " -m <msgid>[,...]    Only records with these message IDs.  May be repeated.\n"
+                    " -b <time>           Only records received at or after this time.\n"
+                    " -e <time>           Only records received before this time.\n"
+                    "                     Times are seconds since POSIX epoch.  eg. 1617248700.5\n"
+                    " -r <sec>            Records may be out of time order by up to this much.  (default 1)\n"
+                    " -l                  List each record.\n"
+                    " -o <column>=<file>  Write one column of native endian binary values to a file.  May be repeated.\n"
+                    " -s </shmname>       Follow live records from this shared memory segment instead of reading files.\n"
+                    "\n"
+                    "Columns:\n"
+                    "  time    f64  reception time, seconds since POSIX epoch\n"
+                    "  sec     u32  reception time, seconds part\n"
+                    "  nsec    u32  reception time, nanoseconds part\n"
+                    "  msgid   u16\n"
+                    "  len     u32  body length\n"
+                    "  file    u32  index of input file\n"
+                    "  offset  u64  position in input file\n"
+                    "  chunk   u64  chunk number of a striped recording\n"
+                    "  <type>@<off>  big endian value from body at byte offset <off>.\n"
+                    "                <type> is one of u8 i8 u16 i16 u32 i32 u64 i64 f32 f64.\n"
+                    "                Written as zero if the body is too short.\n"
+                    , argv0, argv0);
+}
+
+// parse decimal seconds exactly, as a double has only ~100ns resolution for present day times
+epicsUInt64 parseTime(const char *str)
+{
+    epicsUInt64 sec = 0u, nsec = 0u;
+    const char *pos = str;
+    for(; *pos>='0' && *pos<='9'; pos++)
+        sec = sec*10u + (*pos-'0');
+    if(*pos=='.') {
+        pos++;
+        epicsUInt64 scale = 100000000u;
+        for(; *pos>='0' && *pos<='9'; pos++, scale/=10u)
+            nsec += (*pos-'0')*scale; // digits beyond ns are ignored
+    }
+    if(pos==str || *pos || sec>0xffffffffu)
+        throw std::runtime_error(std::string("Invalid time: ")+str);
+    return sec*1000000000u + nsec;
+}
+
+struct Column {
+    enum kind_t {Time, Sec, NSec, MsgID, Len, File, Offset, Chunk, Body} kind;
+    // for Body
+    char type;       // 'u', 'i', or 'f'
+    unsigned width;  // bytes
+    size_t boff;
+
+    std::string fname;
+    FILE *fp;
+    size_t nshort;
+
+    Column() :kind(Time), type('u'), width(0u), boff(0u), fp(0), nshort(0u) {}
+
+    void parse(const std::string& spec)
+    {
+        size_t sep = spec.find('=');
+        if(sep==std::string::npos || sep==0u || sep+1u==spec.size())
+            throw std::runtime_error("Expected <column>=<file>, not: "+spec);
+        std::string col(spec.substr(0, sep));
+        fname = spec.substr(sep+1u);
+
+        if(col=="time") kind = Time;
+        else if(col=="sec") kind = Sec;
+        else if(col=="nsec") kind = NSec;
+        else if(col=="msgid") kind = MsgID;
+        else if(col=="len") kind = Len;
+        else if(col=="file") kind = File;
+        else if(col=="offset") kind = Offset;
+        else if(col=="chunk") kind = Chunk;
+        else {
+            unsigned bits = 0u;
+            char t = 0;
+            int n = 0;
+            if(sscanf(col.c_str(), "%c%u@%zu%n", &t, &bits, &boff, &n)!=3 || size_t(n)!=col.size()
+                    || !(t=='u' || t=='i' || t=='f')
+                    || !(bits==8u || bits==16u || bits==32u || bits==64u)
+                    || (t=='f' && bits<32u))
+                throw std::runtime_error("Unknown column: "+col);
+            kind = Body;
+            type = t;
+            width = bits/8u;
+        }
+    }
+
+    void open()
+    {
+        fp = fopen(fname.c_str(), "wb");
+        if(!fp)
+            throw std::runtime_error("Unable to open "+fname+" : "+strerror(errno));
+        // columns are usually large
+        (void)setvbuf(fp, 0, _IOFBF, 1u<<20u);
+    }
+
+    void close()
+    {
+        if(fp && fclose(fp))
+            throw std::runtime_error("Error writing "+fname+" : "+strerror(errno));
+        fp = 0;
+    }
+
+    template<typename T>
+    void put(T val) { (void)fwrite(&val, sizeof(val), 1u, fp); }
+
+    void write(const UDPRecord& rec)
+    {
+        switch(kind) {
+        case Time: put<double>(rec.sec + rec.nsec*1e-9); break;
+        case Sec: put<epicsUInt32>(rec.sec); break;
+        case NSec: put<epicsUInt32>(rec.nsec); break;
+        case MsgID: put<epicsUInt16>(rec.msgid); break;
+        case Len: put<epicsUInt32>(rec.bodylen); break;
+        case File: put<epicsUInt32>(rec.file); break;
+        case Offset: put<epicsUInt64>(rec.offset); break;
+        case Chunk: put<epicsUInt64>(rec.chunk); break;
+        case Body: {
+            epicsUInt64 raw = 0u;
+            if(boff + width <= rec.bodylen) {
+                const epicsUInt8 *B = reinterpret_cast<const epicsUInt8*>(rec.body + boff);
+                for(unsigned i=0; i<width; i++)
+                    raw = (raw<<8u) | B[i];
+            } else {
+                nshort++;
+            }
+            switch(type) {
+            case 'f':
+                if(width==4u) {
+                    epicsUInt32 bits = epicsUInt32(raw);
+                    float val;
+                    memcpy(&val, &bits, sizeof(val));
+                    put(val);
+                } else {
+                    double val;
+                    memcpy(&val, &raw, sizeof(val));
+                    put(val);
+                }
+                break;
+            case 'i':
+                switch(width) {
+                case 1u: put(epicsInt8(raw)); break;
+                case 2u: put(epicsInt16(raw)); break;
+                case 4u: put(epicsInt32(raw)); break;
+                default: put(epicsInt64(raw)); break;
+                }
+                break;
+            default:
+                switch(width) {
+                case 1u: put(epicsUInt8(raw)); break;
+                case 2u: put(epicsUInt16(raw)); break;
+                case 4u: put(epicsUInt32(raw)); break;
+                default: put(epicsUInt64(raw)); break;
+                }
+                break;
+            }
+        }
+            break;
+        }
+    }
+};
+
+struct Summary {
+    size_t count;
+    epicsUInt64 bytes;
+    epicsUInt64 first, last;
+    Summary() :count(0u), bytes(0u), first(0u), last(0u) {}
+};
+
+void printTime(FILE *fp, epicsUInt64 T)
+{
+    fprintf(fp, "%llu.%09u", (unsigned long long)(T/1000000000u), unsigned(T%1000000000u));
+}
+
+volatile sig_atomic_t interrupted;
+
+void onInterrupt(int)
+{
+    interrupted = 1;
+}
+
+struct Output {
+    bool list;
+    std::vector<Column> columns;
+    std::map<epicsUInt16, Summary> summary;
+
+    Output() :list(false) {}
+
+    void add(const UDPRecord& rec, const std::string& source)
+    {
+        if(list) {
+            printTime(stdout, rec.time());
+            printf(" msgid=%u len=%u %s:%llu\n", rec.msgid, unsigned(rec.bodylen),
+                   source.c_str(), (unsigned long long)rec.offset);
+        }
+
+        for(size_t c=0; c<columns.size(); c++)
+            columns[c].write(rec);
+
+        Summary& S = summary[rec.msgid];
+        if(!S.count++)
+            S.first = rec.time();
+        S.last = rec.time();
+        S.bytes += rec.bodylen;
+    }
+};
+
+void follow(const std::string& shmname, const UDPFilter& filter, Output& out)
+{
+    UDPShmReader live(shmname);
+    std::vector<char> body;
+    UDPRecord rec;
+
+    (void)signal(SIGINT, &onInterrupt);
+    (void)signal(SIGTERM, &onInterrupt);
+
+    while(!interrupted) {
+        if(!live.next(rec)) {
+            (void)usleep(1000);
+            continue;
+        }
+        // the writer may overwrite at any time, so copy out before using
+        body.assign(rec.body, rec.body + rec.bodylen);
+        if(!live.valid())
+            continue;
+        rec.body = body.empty() ? 0 : &body[0];
+
+        if(filter.match(rec))
+            out.add(rec, shmname);
+    }
+
+    if(live.overruns())
+        fprintf(stderr, "Warning: fell behind %zu times, losing %llu bytes\n",
+                live.overruns(), (unsigned long long)live.lost());
+}
+
+int run(int argc, char *argv[])
+{
+    UDPFilter filter;
+    Output out;
+    std::string shmname;
+
+    {
+        int opt;
+        while((opt = getopt(argc, argv, "hm:b:e:r:lo:s:")) != -1) {
+            switch(opt) {
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            case 'm': {
+                std::string ids(optarg);
+                size_t pos = 0u;
+                while(pos<=ids.size()) {
+                    size_t sep = ids.find(',', pos);
+                    if(sep==std::string::npos)
+                        sep = ids.size();
+                    std::string id(ids.substr(pos, sep-pos));
+                    char *end = 0;
+                    unsigned long val = strtoul(id.c_str(), &end, 0);
+                    if(id.empty() || *end || val>0xffff)
+                        throw std::runtime_error("Invalid msgid: "+id);
+                    filter.allow(epicsUInt16(val));
+                    pos = sep+1u;
+                }
+            }
+                break;
+            case 'b':
+                filter.begin = parseTime(optarg);
+                break;
+            case 'e':
+                filter.end = parseTime(optarg);
+                break;
+            case 'r':
+                filter.slack = parseTime(optarg);
+                break;
+            case 'l':
+                out.list = true;
+                break;
+            case 'o':
+                out.columns.push_back(Column());
+                out.columns.back().parse(optarg);
+                break;
+            case 's':
+                shmname = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    }
+
+    if(shmname.empty() ? optind>=argc : optind<argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Column>& columns = out.columns;
+    for(size_t c=0; c<columns.size(); c++)
+        columns[c].open();
+
+    if(!shmname.empty()) {
+        follow(shmname, filter, out);
+
+    } else {
+        UDPMergeReader reader(filter);
+        for(int i=optind; i<argc; i++)
+            reader.add(argv[i]);
+
+        UDPRecord rec;
+
+        while(reader.next(rec))
+            out.add(rec, reader.file(rec.file).name());
+
+        for(size_t i=0; i<reader.nfiles(); i++) {
+            const UDPDataFile& F = reader.file(i);
+            if(!reader.pastEnd(i) && reader.position(i) < F.size())
+                fprintf(stderr, "Warning: %s has %llu bytes of invalid/padding data after offset %llu\n",
+                        F.name().c_str(), (unsigned long long)(F.size() - reader.position(i)),
+                        (unsigned long long)reader.position(i));
+            if((filter.begin || filter.end!=epicsUInt64(-1)) && reader.disorder(i) > filter.slack) {
+                fprintf(stderr, "Warning: %s has records ", F.name().c_str());
+                printTime(stderr, reader.disorder(i));
+                fprintf(stderr, " sec. out of time order.  Use -r to read the complete time window.\n");
+            }
+        }
+    }
+
+    for(size_t c=0; c<columns.size(); c++) {
+        columns[c].close();
+        if(columns[c].nshort)
+            fprintf(stderr, "Warning: %zu records too short for %s\n", columns[c].nshort, columns[c].fname.c_str());
+    }
+
+    if(!out.list && columns.empty()) {
+        printf("# msgid count bytes first last\n");
+        for(std::map<epicsUInt16, Summary>::const_iterator it(out.summary.begin()), end(out.summary.end());
+            it!=end; ++it)
+        {
+            printf("%u %zu %llu ", it->first, it->second.count, (unsigned long long)it->second.bytes);
+            printTime(stdout, it->second.first);
+            printf(" ");
+            printTime(stdout, it->second.last);
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    try {
+        return run(argc, argv);
+    } catch(std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
@@ -6,17 +6,25 @@
 \*************************************************************************/
 
 #include <sstream>
+#include <algorithm>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <netinet/udp.h>
+#include <linux/filter.h>
 
 #include <string.h>
 #include <limits.h>
+#include <time.h>
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
 
 #include <osiSock.h>
 #include <osiUnistd.h>
 #include <epicsMath.h>
+#include <epicsStdlib.h>
 #include <errlog.h>
 #include <epicsStdio.h>
 #include <epicsAtomic.h>
@@ -26,7 +34,13 @@
 #include <osiFileName.h>
 
 #include <psc/device.h>
+#include <psc/thread.h>
+#include <psc/mcast.h>
+#include "utilpvt.h"
 #include "udpdrv.h"
+#include "udpwriter.h"
+#include "udpreader.h"
+#include "udpshm.h"
 
 #include <epicsExport.h>
 
@@ -48,6 +62,49 @@ double PSCUDPMaxLenMB = 2000;
 int PSCUDPSetSockBuf = 0;
 
 int PSCUDPDSyncSizeMB = 0;
+// number of file writes kept in flight with io_uring.  Zero for synchronous writev()
+int PSCUDPURingDepth = 0;
+// if non-zero, write data files with O_DIRECT through a staging buffer of this size (MB)
+int PSCUDPDirectIOMB = 0;
+// if non-zero, create and preallocate the next data file in advance
+int PSCUDPPreAlloc = 0;
+// if non-zero, pace page cache writeback in chunks of this size (MB)
+int PSCUDPWritebackMB = 0;
+// if positive, compress data files with zstd at this level
+int PSCUDPCompressLevel = 0;
+// number of compression worker threads per instance
+int PSCUDPCompressThreads = 2;
+// if non-zero, write a .idx sidecar entry every this many packets
+int PSCUDPIndexPackets = 0;
+// if non-zero, write a .idx sidecar entry at least this often (seconds)
+double PSCUDPIndexPeriod = 0.0;
+// size of each chunk of a striped recording (MB)
+int PSCUDPStripeChunkMB = 4;
+// if non-zero, drop packets not from a peer, or with an invalid header, in the kernel
+int PSCUDPSocketFilter = 1;
+// bounds of adaptive recvmmsg() batch size.  Zero max for socket buffer size / packet size
+int PSCUDPBatchMin = 16;
+int PSCUDPBatchMax = 0;
+// if non-zero, request kernel RX timestamps to measure latency until Block cache update
+int PSCUDPRxTimestamp = 0;
+// if non-zero, set SO_BUSY_POLL (and SO_PREFER_BUSY_POLL) to this many microseconds
+int PSCUDPBusyPollUS = 0;
+// if non-zero, spin on non-blocking recvmmsg() for up to this many microseconds before blocking
+int PSCUDPSpinUS = 0;
+// if non-zero, allow packet buffer pool to grow up to this size (MB)
+int PSCUDPPoolMaxMB = 0;
+// packet buffer pool grows and shrinks in chunks of this size (MB)
+int PSCUDPPoolChunkMB = 16;
+// time (sec) with low packet buffer pool usage before shrinking
+double PSCUDPPoolShrinkPeriod = 10.0;
+// if non-zero, the Block cache takes packet buffers instead of copying when packets are not otherwise needed
+int PSCUDPZeroCopyCache = 1;
+// number of pre-allocated transmit buffers.  Limits messages queued but not yet sent
+int PSCUDPTxRing = 64;
+// if non-zero, enable UDP_GRO to receive coalesced datagrams, which are split in user space
+int PSCUDPGRO = 0;
+// consecutive mostly empty recvmmsg() calls before shrinking batch size
+const unsigned batchShrinkAfter = 64u;
 
 // OS limit on maximum number of iovec passed to writev
 #ifndef IOV_MAX
@@ -56,41 +113,85 @@ int PSCUDPDSyncSizeMB = 0;
 #endif
 size_t iovLimit = IOV_MAX;
 
-struct DataFD {
-    int fd;
-
-    DataFD() :fd(-1) {}
-    ~DataFD() { close(); }
-    void close() {
-        if(fd>=0)
-            ::close(fd);
-        fd = -1;
+// split a list of directories.  Empty entries are ignored
+void splitDirs(const std::string& list, std::vector<std::string>& dirs)
+{
+    dirs.clear();
+    size_t pos = 0u;
+    while(pos<=list.size()) {
+        size_t sep = list.find(OSI_PATH_LIST_SEPARATOR, pos);
+        if(sep==std::string::npos)
+            sep = list.size();
+        if(sep>pos)
+            dirs.push_back(list.substr(pos, sep-pos));
+        pos = sep+1u;
     }
-    bool isOpen() const { return fd>=0; }
+}
 
-private:
-    DataFD(const DataFD&);
-    DataFD& operator=(const DataFD&);
-};
+// receive buffer for coalesced datagrams.  UDP GRO stops at 64 KB
+const size_t groBufSize = 65536u;
+
+// 8-bit BPF jump offsets limit the # of peers which the socket filter can match
+const size_t maxPeers = 64u;
 
-struct PTimer {
-    const std::string name;
-    epicsUInt64 worst;
-    epicsUInt64 tstart;
-    explicit PTimer(const std::string& name) : name(name), worst(0.0), tstart(0u) {}
-    void start() {
-        tstart = epicsMonotonicGet();
+// Attach a classic BPF program to drop datagrams not from one of 'peers', or without a valid PSC header,
+// before they are queued to the socket.  Mirrors the checks in rxfn().
+// UDP socket filters see the UDP header at offset 0, with the PSC header following.
+int attachFilter(SOCKET sock, const UDPFast::peers_t& peers, epicsUInt32 maxbody)
+{
+    const size_t npeers = peers.size();
+    assert(npeers>0u && npeers<=maxPeers);
+
+    std::vector<sock_filter> prog;
+    prog.reserve(4u*npeers + 11u);
+
+    // for each peer, match source address and port, then jump to header checks.
+    // the last mismatch falls through to drop.
+    for(size_t i=0; i<npeers; i++) {
+        const osiSockAddr& peer = peers[i].addr;
+        const epicsUInt8 tohdr = epicsUInt8(4u*(npeers-i) - 3u);
+        const sock_filter match[] = {
+            /* 0 */ BPF_STMT(BPF_LD|BPF_W|BPF_ABS, epicsUInt32(SKF_NET_OFF+12)), // IPv4 source address
+            /* 1 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ntohl(peer.ia.sin_addr.s_addr), 0, 2),
+            /* 2 */ BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 0),               // UDP source port
+            /* 3 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ntohs(peer.ia.sin_port), tohdr, 0),
+        };
+        prog.insert(prog.end(), match, match+4u);
     }
-    void stop() {
-        epicsUInt64 tend = epicsMonotonicGet();
-        epicsUInt64 delta = tend-tstart; // ns
-        if(delta > worst) {
-            worst = delta;
-            if(PSCDebug>0)
-            errlogPrintf("PTimer %s max %.3f ms\n", name.c_str(), double(delta/1.0e6)); // ns -> ms
-        }
+    const sock_filter hdr[] = {
+        /*  0 */ BPF_STMT(BPF_RET|BPF_K, 0),                      // no peer matched
+        /*  1 */ BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 8),               // 'P', 'S'
+        /*  2 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x5053, 0, 7),
+        /*  3 */ BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 4),               // UDP length, including UDP header
+        /*  4 */ BPF_STMT(BPF_ALU|BPF_SUB|BPF_K, 16u),            // less UDP and PSC headers
+        /*  5 */ BPF_STMT(BPF_MISC|BPF_TAX, 0),
+        /*  6 */ BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 12),              // PSC body length.  drops if <16 bytes
+        /*  7 */ BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, maxbody, 2, 0),  // larger than buffer
+        /*  8 */ BPF_JUMP(BPF_JMP|BPF_JGT|BPF_X, 0, 1, 0),        // truncated
+        /*  9 */ BPF_STMT(BPF_RET|BPF_K, 0xffffffff),             // accept whole datagram
+        /* 10 */ BPF_STMT(BPF_RET|BPF_K, 0),                      // drop
+    };
+    prog.insert(prog.end(), hdr, hdr+sizeof(hdr)/sizeof(hdr[0]));
+
+    sock_fprog fprog;
+    fprog.len = prog.size();
+    fprog.filter = &prog[0];
+
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+}
+
+// close and destroy all stripe writers, collecting their buffers
+void destroyStripes(std::vector<StripeWriter*>& stripes, UDPFast::pkts_t& done)
+{
+    for(size_t s=0; s<stripes.size(); s++)
+        stripes[s]->close();
+    for(size_t s=0; s<stripes.size(); s++) {
+        stripes[s]->drain();
+        (void)stripes[s]->reap(done);
+        delete stripes[s];
     }
-};
+    stripes.clear();
+}
 
 } // namespace
 
@@ -100,6 +201,7 @@ void UDPFast::pkt::swap(pkt &o)
         std::swap(body, o.body);
         std::swap(bodylen, o.bodylen);
         std::swap(rxtime, o.rxtime);
+        std::swap(kerntime, o.kerntime);
         std::swap(msgid, o.msgid);
     }
 }
@@ -111,21 +213,43 @@ UDPFast::UDPFast(const std::string& name,
     :PSCBase (name, host, port)
     ,sock(epicsSocketCreate(AF_INET, SOCK_DGRAM, 0))
     ,running(1)
+    ,gro(false)
+    ,ngrow(0u)
+    ,nshrink(0u)
+    ,poolQuiet(0u)
     ,rxcnt(0u)
     ,ntimeout(0u)
     ,ndrops(0u)
     ,nignore(0u)
     ,noom(0u)
+    ,ngro(0u)
     ,lastsize(0u)
     ,netrx(0u)
     ,storewrote(0u)
+    ,compin(0u)
+    ,compout(0u)
+    ,ntx(0u)
+    ,ntxerr(0u)
     ,reopen(true)
     ,record(false)
-    ,shortLimit(0u)
+    ,trigMode(false)
+    ,trigPre(1.0)
+    ,trigPost(1.0)
+    ,trigPending(false)
+    ,capturing(false)
+    ,ntrig(0u)
+    ,nfiltered(0u)
+    ,seqHeld(0u)
+    ,shortRoom(0u)
+    ,replaySrc(0)
+    ,replaySpeed(1.0)
+    ,shm(0)
     ,rxjob(this)
     ,rxworker(rxjob, "udpfrx", epicsThreadGetStackSize(epicsThreadStackBig), epicsThreadPriorityHigh+1)
     ,cachejob(this)
     ,cacheworker(cachejob, "udpfc", epicsThreadGetStackSize(epicsThreadStackBig), epicsThreadPriorityHigh-1)
+    ,txjob(this)
+    ,txworker(txjob, "udpftx", epicsThreadGetStackSize(epicsThreadStackSmall), epicsThreadPriorityHigh)
 {
     if(sock==INVALID_SOCKET)
         throw std::bad_alloc();
@@ -145,7 +269,45 @@ UDPFast::UDPFast(const std::string& name,
         if(setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &flag, sizeof(flag)))
             fprintf(stderr, "Unable to set SO_RXQ_OVFL");
     }
-    // TODO: set SO_RCVBUF, SO_INCOMING_CPU, SO_BUSY_POLL ?
+    if(PSCUDPRxTimestamp) {
+        int flag = 1;
+        if(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &flag, sizeof(flag)))
+            fprintf(stderr, "Unable to set SO_TIMESTAMPNS");
+    }
+    if(PSCUDPGRO) {
+#ifdef UDP_GRO
+        // Linux >= 5.0
+        int flag = 1;
+        if(setsockopt(sock, SOL_UDP, UDP_GRO, &flag, sizeof(flag))) {
+            int err = errno;
+            fprintf(stderr, "Unable to set UDP_GRO : %s (%d)\n", strerror(err), err);
+        } else {
+            gro = true;
+        }
+#else
+        fprintf(stderr, "UDP_GRO not supported by this build\n");
+#endif
+    }
+    if(PSCUDPBusyPollUS>0) {
+        // raising above the net.core.busy_read sysctl requires CAP_NET_ADMIN
+        int usec = PSCUDPBusyPollUS;
+        if(setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec))) {
+            int err = errno;
+            fprintf(stderr, "Unable to set SO_BUSY_POLL = %d : %s (%d)\n", usec, strerror(err), err);
+        }
+#ifdef SO_PREFER_BUSY_POLL
+        int flag = 1;
+        if(setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &flag, sizeof(flag)))
+            fprintf(stderr, "Unable to set SO_PREFER_BUSY_POLL\n");
+#endif
+    }
+    {
+        // bound time txfn() may block on a full socket buffer
+        timeval timeout = {1, 0};
+        if(setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)))
+            throw std::runtime_error("Unable to set SO_SNDTIMEO");
+    }
+    // TODO: set SO_INCOMING_CPU ?
 
     unsigned rxbuflen = PSCUDPSetSockBuf; // in bytes
     {
@@ -171,21 +333,62 @@ UDPFast::UDPFast(const std::string& name,
     // recvmmsg() can only deque as many as can fit it the socket buffer
     // Not considering that Linux _may_ apply a 2x multiplier
     batchSize = std::min(std::max<size_t>(1u, rxbuflen/maxpktlen), iovLimit);
-    printf("  batch size %zu\n", batchSize);
+    if(gro) // each receive may fill a groBufSize buffer
+        batchSize = std::min(batchSize, std::max<size_t>(1u, rxbuflen/groBufSize));
+    if(PSCUDPBatchMax>0)
+        batchSize = std::min(batchSize, size_t(PSCUDPBatchMax));
+    batchMin = std::min(batchSize, size_t(std::max(1, PSCUDPBatchMin)));
+    batchActive = batchSize;
+    for(size_t i=0; i<batchHistSize; i++)
+        batchHist[i] = 0u;
+    for(size_t i=0; i<rxLatHistSize; i++)
+        rxLatHist[i] = 0u;
+    printf("  batch size %zu - %zu%s\n", batchMin, batchSize, gro ? " (GRO)" : "");
 
     // pre-allocate buffers to handle 2 periods of data.
     // one accumulating, and another flushing
     vpoolTotal = size_t(std::max(1.0, 2*PSCUDPMaxPacketRate*PSCUDPBufferPeriod));
+    vpoolMin = vpoolTotal;
+    vpoolMax = std::max(vpoolMin, (size_t(std::max(0, PSCUDPPoolMaxMB))<<20u)/maxpktlen);
+    vpoolChunk = std::max<size_t>(1u, (size_t(std::max(1, PSCUDPPoolChunkMB))<<20u)/maxpktlen);
+    vpoolBufSize = maxpktlen;
+    // place buffers on the NUMA node of the RX thread, if configured
+    const int node = pscThreadNode("udpfrx", name.c_str());
+    pscNodePolicy prevNode;
+    const bool prefer = node>=0 && pscThreadPreferNode(node, &prevNode)==0;
+    if(node>=0 && !prefer)
+        fprintf(stderr, "Unable to prefer NUMA node %d\n", node);
     vpool.resize(vpoolTotal);
     for(size_t i=0; i<vpool.size(); i++)
         vpool[i].resize(maxpktlen);
     printf("  vpool cnt=%zu size=%u b\n", vpool.size(), maxpktlen);
+    if(vpoolMax > vpoolMin)
+        printf("  vpool max cnt=%zu chunk=%zu\n", vpoolMax, vpoolChunk);
 
     pending.reserve(vpool.size());
 
-    if(aToIPAddr(host.c_str(), port, &peer.ia))
+    {
+        const size_t ntxbuf = size_t(std::max(1, PSCUDPTxRing));
+        txFree.resize(ntxbuf);
+        for(size_t i=0; i<ntxbuf; i++)
+            txFree[i].buf.reserve(8u + maxpktlen);
+        txQueued.reserve(ntxbuf);
+        txReady.reserve(ntxbuf);
+    }
+    if(prefer)
+        (void)pscThreadRestoreNode(&prevNode);
+
+    peers.resize(1u);
+    peers[0].label = host;
+    if(aToIPAddr(host.c_str(), port, &peers[0].addr.ia))
         throw std::runtime_error("Bad host/IP");
 
+    // before bind() so that no junk is queued
+    if(PSCUDPSocketFilter && attachFilter(sock, peers, maxpktlen)) {
+        int err = errno;
+        fprintf(stderr, "Unable to set SO_ATTACH_FILTER : %s (%d)\n", strerror(err), err);
+    }
+
     memset(&self, 0, sizeof(self));
     self.ia.sin_family = AF_INET;
     self.ia.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -204,9 +407,59 @@ UDPFast::UDPFast(const std::string& name,
 UDPFast::~UDPFast()
 {
     epicsSocketDestroy(sock);
+    delete replaySrc;
+    delete shm;
+}
+
+void UDPFast::addPeer(const std::string& label, const std::string& host, unsigned short port, epicsUInt16 msgbase)
+{
+    if(connected)
+        throw std::runtime_error("Peers must be added before iocInit()");
+    if(replaySrc)
+        throw std::runtime_error("Replay does not receive from peers");
+    if(peers.size()>=maxPeers)
+        throw std::runtime_error("Too many peers");
+
+    Peer P;
+    P.label = label;
+    P.msgbase = msgbase;
+    if(label.empty() || label.find_first_of(" \t")!=label.npos)
+        throw std::runtime_error("Peer label must be non-empty, without whitespace");
+    if(aToIPAddr(host.c_str(), port, &P.addr.ia))
+        throw std::runtime_error("Bad host/IP");
+
+    for(size_t i=0; i<peers.size(); i++) {
+        if(peers[i].label==label)
+            throw std::runtime_error("Duplicate peer label '"+label+"'");
+        if(evutil_sockaddr_cmp(&peers[i].addr.sa, &P.addr.sa, 1)==0)
+            throw std::runtime_error("Duplicate peer address for '"+label+"'");
+        if(peers[i].msgbase==msgbase)
+            fprintf(stderr, "Warning: peers '%s' and '%s' share msgid base %u\n",
+                    peers[i].label.c_str(), label.c_str(), unsigned(msgbase));
+    }
+
+    if(!mcastGroup.empty()) {
+        if(int err = pscJoinMulticast(sock, mcastGroup.c_str(), mcastIface.c_str(), &P.addr.ia))
+            throw std::runtime_error("Unable to join "+mcastGroup+" for '"+label+"' : "+strerror(err));
+    }
+
+    peers.push_back(P);
+
+    // replaces the previous filter
+    if(PSCUDPSocketFilter && attachFilter(sock, peers, vpoolBufSize)) {
+        int err = errno;
+        fprintf(stderr, "Unable to set SO_ATTACH_FILTER : %s (%d)\n", strerror(err), err);
+    }
 }
 
 void UDPFast::rxfn() {
+    pscThreadApply("udpfrx", name.c_str());
+
+    if(replaySrc) {
+        replayfn();
+        return;
+    }
+
     if(PSCDebug>=2)
         errlogPrintf("%s : rx worker starts\n", name.c_str());
 
@@ -214,6 +467,7 @@ void UDPFast::rxfn() {
 
     struct message {
         std::vector<char> buf; // body buffer (swapped out frequently)
+        std::vector<char> gbuf; // with UDP_GRO, whole datagrams.  Split by splitGRO()
         osiSockAddr src;
         iovec io[2]; // receive header and body into separate buffers
         union {
@@ -226,13 +480,21 @@ void UDPFast::rxfn() {
         };
         union {
             cmsghdr _calign; // CMSG_* access macros assume alignment
-            char cbuf[CMSG_SPACE(4u)]; // space for SO_RXQ_OVFL
+            // space for SO_RXQ_OVFL, SO_TIMESTAMPNS, and UDP_GRO
+            char cbuf[CMSG_SPACE(4u) + CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(int))];
         };
     };
 
     std::vector<mmsghdr> headers(batchSize);
     std::vector<message> msgs(headers.size());
     bool notifycache = false;
+    size_t ipeer = 0u; // last matched peer
+    // adaptive batch size.  Grow quickly when a call fills the batch,
+    // shrink slowly when calls are mostly empty.
+    size_t nbatch = batchActive;
+    unsigned nsmall = 0u;
+    // non-blocking spin budget.  See PSCUDPSpinUS
+    const epicsUInt64 spinNS = epicsUInt64(std::max(0, PSCUDPSpinUS))*1000u;
 
     Guard G(rxLock);
 
@@ -250,12 +512,17 @@ void UDPFast::rxfn() {
         }
 
         // assign buffers
-        size_t nassign = msgs.size();
+        size_t nassign = nbatch;
         for(size_t i=0; i<nassign; i++) {
             msghdr& hdr = headers[i].msg_hdr;
             message& msg = msgs[i];
 
-            if(!msg.buf.empty()) {
+            if(gro) {
+                // segments are copied to vpool buffers by splitGRO()
+                if(msg.gbuf.empty())
+                    msg.gbuf.resize(groBufSize);
+
+            } else if(!msg.buf.empty()) {
                 // re-use leftovers
 
             } else if(vpool.empty()) {
@@ -279,16 +546,22 @@ void UDPFast::rxfn() {
             hdr.msg_control = &msg.cbuf;
             hdr.msg_controllen = sizeof(msg.cbuf);
             hdr.msg_iov = msg.io;
-            hdr.msg_iovlen = 2u;
 
-            msg.io[0].iov_base = msg.hbuf;
-            msg.io[0].iov_len = sizeof(msg.hbuf);
+            if(gro) {
+                hdr.msg_iovlen = 1u;
+                msg.io[0].iov_base = &msg.gbuf[0];
+                msg.io[0].iov_len = msg.gbuf.size();
+            } else {
+                hdr.msg_iovlen = 2u;
+                msg.io[0].iov_base = msg.hbuf;
+                msg.io[0].iov_len = sizeof(msg.hbuf);
+            }
         }
 
-        if(nassign < msgs.size()) {
+        if(nassign < nbatch) {
             if(PSCDebug>=2)
                 errlogPrintf("%s : insufficient buffers for for recvmmsg %zu < %zu\n",
-                             name.c_str(), nassign, msgs.size());
+                             name.c_str(), nassign, nbatch);
 
         } else {
             if(PSCDebug>=5)
@@ -296,6 +569,7 @@ void UDPFast::rxfn() {
         }
 
         size_t nrx = 0u;
+        bool shrunk = false;
         {
             UnGuard U(G);
 
@@ -307,13 +581,24 @@ void UDPFast::rxfn() {
             }
 
             if(nassign) {
-                int ret = recvmmsg(sock, &headers[0], nassign, MSG_WAITFORONE, 0);
+                int ret = -1;
+                bool wait = true;
+                if(spinNS) {
+                    // trade a core for wakeup latency
+                    const epicsUInt64 deadline = epicsMonotonicGet() + spinNS;
+                    do {
+                        ret = recvmmsg(sock, &headers[0], nassign, MSG_DONTWAIT, 0);
+                        wait = ret<0 && (errno==EAGAIN || errno==EWOULDBLOCK);
+                    } while(wait && epicsMonotonicGet() < deadline && epics::atomic::get(running));
+                }
+                if(wait)
+                    ret = recvmmsg(sock, &headers[0], nassign, MSG_WAITFORONE, 0);
 
                 int lvl = 5;
                 if(ret<0)
                     lvl = 1;
                 else if(size_t(ret)==nassign)
-                    lvl = 3; // could have used larget PSCUDPBatchSize
+                    lvl = 3; // could have used larger batch
                 if(PSCDebug >= lvl)
                     errlogPrintf("%s : recvmmsg() -> %d (%d)\n", name.c_str(), ret, int(SOCKERRNO));
 
@@ -330,10 +615,29 @@ void UDPFast::rxfn() {
 
                 } else {
                     nrx = size_t(ret);
+
+                    size_t bucket = 0u;
+                    for(size_t n=nrx; n>1u && bucket+1u<batchHistSize; n>>=1u)
+                        bucket++;
+                    epicsAtomicIncrSizeT(&batchHist[bucket]);
+
+                    if(nrx==nbatch) {
+                        nbatch = std::min(batchSize, nbatch*2u);
+                        nsmall = 0u;
+                    } else if(nrx*4u < nbatch && ++nsmall >= batchShrinkAfter) {
+                        nbatch = std::max(batchMin, nbatch/2u);
+                        nsmall = 0u;
+                        shrunk = true;
+                    } else if(nrx*4u >= nbatch) {
+                        nsmall = 0u;
+                    }
+                    epicsAtomicSetSizeT(&batchActive, nbatch);
                 }
             }
             // re-lock
         }
+        if(!epics::atomic::get(running))
+            break; // after stop(), receives return immediately with nothing
         epicsTimeStamp rxtime;
         // all messages in a batch will have the same RX time
         epicsTimeGetCurrent(&rxtime);
@@ -347,6 +651,8 @@ void UDPFast::rxfn() {
             size_t len = headers[i].msg_len;
             message& msg = msgs[i];
             epicsUInt32 ndrops = 0;
+            epicsTimeStamp kerntime = {0u, 0u};
+            size_t segsize = 0u; // UDP_GRO segment size
 
             if(hdr.msg_flags & MSG_CTRUNC) {
                 // this will absolutely spam the console, but represents a logic error in sizing msg.cbuf
@@ -366,34 +672,87 @@ void UDPFast::rxfn() {
                             errlogPrintf("%s : socket buffer overflow.  lost %u\n", name.c_str(), ndrops-prevndrops);
                         prevndrops = ndrops;
                     }
+                } else if(cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS && cmsg->cmsg_len>=CMSG_LEN(sizeof(timespec))) {
+                    timespec ts;
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    (void)epicsTimeFromTimespec(&kerntime, &ts);
+                }
+#ifdef UDP_GRO
+                else if(cmsg->cmsg_level==SOL_UDP && cmsg->cmsg_type == UDP_GRO && cmsg->cmsg_len>=CMSG_LEN(sizeof(int))) {
+                    int gsosize;
+                    memcpy(&gsosize, CMSG_DATA(cmsg), sizeof(gsosize));
+                    segsize = size_t(std::max(0, gsosize));
                 }
+#endif
             }
 
-            if(evutil_sockaddr_cmp(&peer.sa, &msg.src.sa, 1)!=0) {
+            // consecutive packets are likely from the same peer
+            bool known = evutil_sockaddr_cmp(&peers[ipeer].addr.sa, &msg.src.sa, 1)==0;
+            for(size_t p=0; !known && p<peers.size(); p++) {
+                if(evutil_sockaddr_cmp(&peers[p].addr.sa, &msg.src.sa, 1)==0) {
+                    ipeer = p;
+                    known = true;
+                }
+            }
+
+            if(!known) {
                 epicsAtomicIncrSizeT(&nignore);
-                if(PSCDebug>0)
+                if(PSCDebug>=2)
                     errlogPrintf("%s : ignore packet not from peer\n", name.c_str());
                 continue;
 
+            } else if(gro) {
+                // coalesced datagrams are all from one flow, so one peer.
+                // Unlike plain recvmmsg(), the # of packets is not known until received.
+                // If vpool runs out part way through, wait for buffers and resume.
+                size_t off = 0u, nseg = 0u;
+                while(true) {
+                    const bool wasEmpty = pending.empty();
+                    totalrx += splitGRO(msg.gbuf, len, segsize, off, nseg, peers[ipeer], rxtime, kerntime);
+                    notifycache |= wasEmpty && !pending.empty();
+                    if(off>=len || !epics::atomic::get(running))
+                        break;
+
+                    epicsAtomicIncrSizeT(&noom);
+                    if(PSCDebug>=1)
+                        errlogPrintf("%s : vpool stall splitting coalesced packets\n", name.c_str());
+
+                    UnGuard U(G);
+                    if(notifycache) {
+                        // cachefn() must consume 'pending' to free buffers
+                        pendingReady.signal();
+                        notifycache = false;
+                    }
+                    vpoolStall.wait();
+                }
+                if(nseg>1u) {
+                    epicsAtomicIncrSizeT(&ngro);
+                    // counted one packet per receive above
+                    epicsAtomicAddSizeT(&rxcnt, nseg-1u);
+                }
+                continue;
+
             } else if(len<8u) {
                 epicsAtomicIncrSizeT(&nignore);
-                if(PSCDebug>=0)
+                if(PSCDebug>=2)
                     errlogPrintf("%s : truncated packet header\n", name.c_str());
                 continue;
 
             } else if(msg.P!='P' || msg.S!='S') {
                 epicsAtomicIncrSizeT(&nignore);
-                if(PSCDebug>=0)
+                if(PSCDebug>=2)
                     errlogPrintf("%s : invalid header packet\n", name.c_str());
                 continue;
             }
 
-            epicsUInt16 msgid = ntohs(msg.msgid);
+            Peer& peer = peers[ipeer];
+            // each peer has its own range of msgid.  Wraps.
+            epicsUInt16 msgid = epicsUInt16(ntohs(msg.msgid) + peer.msgbase);
             epicsUInt32 blen = ntohl(msg.blen);
 
-            if(blen < len-8u) {
+            if(blen > len-8u) {
                 epicsAtomicIncrSizeT(&nignore);
-                if(PSCDebug>=0)
+                if(PSCDebug>=2)
                     errlogPrintf("%s : truncated packet body %u > %u\n", name.c_str(),
                                  unsigned(blen), unsigned(len-8u));
                 continue;
@@ -404,6 +763,8 @@ void UDPFast::rxfn() {
                         name.c_str(), msgid, (unsigned long)blen);
 
             totalrx += len + 16 + 20 + 8; // add assumed sizes of unseen ethernet, ipv4, and UDP headers
+            epicsAtomicIncrSizeT(&peer.nrx);
+            epicsAtomicAddSizeT(&peer.nbytes, blen);
 
             notifycache |= pending.empty();
             // will signal after unlock to avoid bouncing
@@ -411,10 +772,21 @@ void UDPFast::rxfn() {
             pending.push_back(pkt());
             pending.back().msgid = msgid;
             pending.back().rxtime = rxtime;
+            pending.back().kerntime = kerntime;
             pending.back().body.swap(msg.buf);
             pending.back().bodylen = blen;
         } // for each packet
 
+        if(shrunk) {
+            // return leftovers beyond the reduced batch
+            for(size_t i=nbatch; i<msgs.size(); i++) {
+                if(!msgs[i].buf.empty()) {
+                    vpool.push_back(std::vector<char>());
+                    vpool.back().swap(msgs[i].buf);
+                }
+            }
+        }
+
         epicsAtomicAddSizeT(&netrx, totalrx);
 
     } // main rx
@@ -423,34 +795,539 @@ void UDPFast::rxfn() {
         errlogPrintf("%s : rx worker ends\n", name.c_str());
 } // rxfn()
 
+size_t UDPFast::splitGRO(const std::vector<char>& buf, size_t len, size_t segsize, size_t& off, size_t& nseg,
+                         Peer& peer, const epicsTimeStamp& rxtime, const epicsTimeStamp& kerntime)
+{
+    // all segments have the same size, except perhaps the last.
+    // without a UDP_GRO cmsg, a single datagram.
+    if(!segsize || segsize > len)
+        segsize = len;
+
+    size_t netbytes = 0u;
+
+    for(; off<len; off+=segsize) {
+        if(vpool.empty())
+            break; // caller waits for buffers, then resumes at 'off'
+
+        const size_t seglen = std::min(segsize, len-off);
+        const char *seg = &buf[off];
+        nseg++;
+
+        if(seglen<8u || seg[0]!='P' || seg[1]!='S') {
+            epicsAtomicIncrSizeT(&nignore);
+            if(PSCDebug>=2)
+                errlogPrintf("%s : invalid header packet in coalesced segment %zu\n", name.c_str(), nseg);
+            continue;
+        }
+
+        epicsUInt16 msgid;
+        epicsUInt32 blen;
+        memcpy(&msgid, seg+2, sizeof(msgid));
+        memcpy(&blen, seg+4, sizeof(blen));
+        // each peer has its own range of msgid.  Wraps.
+        msgid = epicsUInt16(ntohs(msgid) + peer.msgbase);
+        blen = ntohl(blen);
+
+        if(blen > seglen-8u || blen > vpoolBufSize) {
+            epicsAtomicIncrSizeT(&nignore);
+            if(PSCDebug>=2)
+                errlogPrintf("%s : truncated packet body %u > %u\n", name.c_str(),
+                             unsigned(blen), unsigned(std::min(seglen-8u, vpoolBufSize)));
+            continue;
+        }
+
+        if(PSCDebug>2)
+            timefprintf(stderr, "%s: recv'd block %u with %lu bytes\n",
+                    name.c_str(), msgid, (unsigned long)blen);
+
+        netbytes += seglen + 16 + 20 + 8; // add assumed sizes of unseen ethernet, ipv4, and UDP headers
+        epicsAtomicIncrSizeT(&peer.nrx);
+        epicsAtomicAddSizeT(&peer.nbytes, blen);
+
+        pending.push_back(pkt());
+        pkt& P = pending.back();
+        P.msgid = msgid;
+        P.rxtime = rxtime;
+        P.kerntime = kerntime;
+        P.body.swap(vpool.back());
+        vpool.pop_back();
+        memcpy(&P.body[0], seg+8u, blen);
+        P.bodylen = blen;
+    }
+    return netbytes;
+}
+
+void UDPFast::replayfn()
+{
+    if(PSCDebug>=2)
+        errlogPrintf("%s : replay worker starts\n", name.c_str());
+
+    UDPFilter all;
+    UDPFileReader reader(*replaySrc, all);
+    UDPRecord rec;
+    bool more = reader.next(rec);
+
+    const epicsUInt64 first = rec.time(); // ns
+    const epicsUInt64 start = epicsMonotonicGet(); // ns
+    epicsTimeStamp startTime;
+    epicsTimeGetCurrent(&startTime);
+
+    vecs_t bufs; // taken from vpool
+    pkts_t batch;
+    bufs.reserve(batchSize);
+    batch.reserve(batchSize);
+    size_t nreplay = 0u;
+
+    // Records with equal times were received by one recvmmsg(), and are replayed together.
+    while(more && epics::atomic::get(running)) {
+        const epicsUInt64 T = rec.time();
+
+        epicsTimeStamp rxtime;
+        if(replaySpeed>0.0) {
+            // keep original (scaled) spacing, even if we fall behind.
+            // Records out of time order, before the first, are replayed immediately.
+            const epicsInt64 since = epicsInt64(T - first); // ns
+            const double offset = std::max<epicsInt64>(0, since)*1e-9/replaySpeed; // sec
+            while(epics::atomic::get(running)) {
+                double delay = offset - (epicsMonotonicGet()-start)*1e-9;
+                if(delay<=0.0)
+                    break;
+                epicsThreadSleep(std::min(delay, 0.1)); // wake periodically to check for stop()
+            }
+            rxtime = startTime;
+            epicsTimeAddSeconds(&rxtime, offset);
+        } else {
+            epicsTimeGetCurrent(&rxtime);
+        }
+
+        {
+            Guard G(rxLock);
+            while(vpool.empty() && epics::atomic::get(running)) {
+                epicsAtomicIncrSizeT(&noom);
+                if(PSCDebug>=1)
+                    errlogPrintf("%s : vpool stall\n", name.c_str());
+
+                UnGuard U(G);
+                vpoolStall.wait();
+            }
+            for(size_t n=std::min(batchSize, vpool.size()); n; n--) {
+                bufs.push_back(vecs_t::value_type());
+                bufs.back().swap(vpool.back());
+                vpool.pop_back();
+            }
+        }
+
+        size_t totalrx = 0u, used = 0u;
+        while(more && rec.time()==T && used<bufs.size()) {
+            std::vector<char>& buf = bufs[used];
+
+            if(rec.bodylen > buf.size()) {
+                epicsAtomicIncrSizeT(&nignore);
+                if(PSCDebug>0)
+                    errlogPrintf("%s : ignore replay packet larger than PSCUDPMaxPacketSize\n", name.c_str());
+
+            } else {
+                memcpy(&buf[0], rec.body, rec.bodylen);
+                batch.push_back(pkt());
+                batch.back().msgid = rec.msgid;
+                batch.back().rxtime = rxtime;
+                batch.back().bodylen = rec.bodylen;
+                batch.back().body.swap(buf);
+                used++;
+                totalrx += 8u + rec.bodylen + 16 + 20 + 8; // as rxfn()
+            }
+            more = reader.next(rec);
+        }
+
+        bool notifycache;
+        {
+            Guard G(rxLock);
+            for(size_t i=used; i<bufs.size(); i++) {
+                vpool.push_back(vecs_t::value_type());
+                vpool.back().swap(bufs[i]);
+            }
+            notifycache = pending.empty() && !batch.empty();
+            for(size_t i=0; i<batch.size(); i++) {
+                pending.push_back(pkt());
+                pending.back().swap(batch[i]);
+            }
+        }
+        if(notifycache)
+            pendingReady.signal();
+
+        epicsAtomicAddSizeT(&rxcnt, batch.size());
+        epicsAtomicAddSizeT(&netrx, totalrx);
+        nreplay += batch.size();
+        bufs.clear();
+        batch.clear();
+    }
+
+    errlogPrintf("%s : replay of \"%s\" %s after %zu packets\n", name.c_str(), replaySrc->name().c_str(),
+                 more ? "stopped" : "complete", nreplay);
+}
+
+void UDPFast::recycle(pkts_t& pkts)
+{
+    const size_t N = pkts.size();
+    pkts_t freed;
+
+    {
+        // keep the first few of each msgid for the "short" buffers
+        Guard S(shortLock);
+        for(size_t i=0; i<N && shortRoom; i++) {
+            if(pkts[i].body.empty())
+                continue;
+            ShortRing *ring = shortIndex[pkts[i].msgid];
+            if(!ring || ring->pkts.size() >= ring->limit)
+                continue;
+            ring->pkts.push_back(pkt());
+            ring->pkts.back().swap(pkts[i]);
+            shortRoom--;
+        }
+        freed.swap(shortFree);
+    }
+
+    if(!N && freed.empty())
+        return;
+
+    bool unstall;
+    {
+        Guard R(rxLock);
+
+        unstall = vpool.empty();
+
+        for(size_t i=0; i<N; i++) {
+            pkt& pkt = pkts[i];
+
+            // empty if buffer was moved to shortRings, or is still held by a DataWriter
+            if(!pkt.body.empty()) {
+                vpool.push_back(vecs_t::value_type()); // shouldn't need to (re)allocate
+                vpool.back().swap(pkt.body);
+                if(PSCDebug>=5)
+                    errlogPrintf("%s : return consumed %zu\n", name.c_str(), i);
+            }
+        }
+        for(size_t i=0, F=freed.size(); i<F; i++) {
+            vpool.push_back(vecs_t::value_type());
+            vpool.back().swap(freed[i].body);
+        }
+
+        unstall &= !vpool.empty();
+    }
+    pkts.clear();
+
+    if(unstall) {
+        if(PSCDebug>=1)
+            errlogPrintf("%s : vpool stall resume\n", name.c_str());
+        vpoolStall.signal();
+    }
+}
+
+void UDPFast::resizePool()
+{
+    if(vpoolMax <= vpoolMin)
+        return;
+
+    const size_t total = vpoolTotal;
+    size_t avail;
+    {
+        Guard R(rxLock);
+        avail = vpool.size();
+    }
+    const size_t inuse = total - std::min(total, avail);
+
+    if(inuse*4u >= total*3u && total < vpoolMax) {
+        // high water.  Allocate outside of rxLock, on the NUMA node of the RX thread
+        const size_t n = std::min(vpoolChunk, vpoolMax - total);
+        const int node = pscThreadNode("udpfrx", name.c_str());
+        pscNodePolicy prevNode;
+        const bool prefer = node>=0 && pscThreadPreferNode(node, &prevNode)==0;
+        vecs_t temp(n);
+        for(size_t i=0; i<n; i++)
+            temp[i].resize(vpoolBufSize);
+        if(prefer)
+            (void)pscThreadRestoreNode(&prevNode);
+
+        bool unstall;
+        {
+            Guard R(rxLock);
+            unstall = vpool.empty();
+            vpool.reserve(total + n);
+            pending.reserve(total + n);
+            for(size_t i=0; i<n; i++) {
+                vpool.push_back(vecs_t::value_type());
+                vpool.back().swap(temp[i]);
+            }
+        }
+        epicsAtomicSetSizeT(&vpoolTotal, total + n);
+        epicsAtomicIncrSizeT(&ngrow);
+        poolQuiet = 0u;
+
+        if(PSCDebug>=1)
+            errlogPrintf("%s : vpool grow to %zu\n", name.c_str(), total + n);
+        if(unstall)
+            vpoolStall.signal();
+
+    } else if(inuse*4u < total && total > vpoolMin) {
+        // low water.  Shrink after a quiet period, and then once per period
+        const epicsUInt64 now = epicsMonotonicGet();
+        if(!poolQuiet) {
+            poolQuiet = now;
+
+        } else if(now - poolQuiet >= epicsUInt64(std::max(0.0, PSCUDPPoolShrinkPeriod)*1e9)) {
+            vecs_t temp;
+            {
+                Guard R(rxLock);
+                const size_t n = std::min(std::min(vpoolChunk, total - vpoolMin), vpool.size());
+                temp.resize(n);
+                for(size_t i=0; i<n; i++) {
+                    temp[i].swap(vpool.back());
+                    vpool.pop_back();
+                }
+            }
+            epicsAtomicSetSizeT(&vpoolTotal, total - temp.size());
+            epicsAtomicIncrSizeT(&nshrink);
+            poolQuiet = now;
+
+            if(PSCDebug>=1)
+                errlogPrintf("%s : vpool shrink to %zu\n", name.c_str(), total - temp.size());
+
+            // free outside of rxLock
+            vecs_t().swap(temp);
+#ifdef __GLIBC__
+            // return freed heap to the OS
+            (void)malloc_trim(0);
+#endif
+        }
+
+    } else {
+        poolQuiet = 0u;
+    }
+}
+
+// Called from cachefn() with lock held.
+// Outside of a capture, packets are moved from 'inprog' to the pre-trigger ring.
+// When a capture begins, the ring is moved to the front of 'inprog'.
+// Packets leaving the ring unwritten are moved to 'done'.
+void UDPFast::triggered(pkts_t& inprog, pkts_t& done, const epicsTimeStamp& now)
+{
+    if(trigPending) {
+        trigPending = false;
+
+        epicsTimeStamp end(trigTime);
+        epicsTimeAddSeconds(&end, trigPost);
+
+        if(!trigMode || !record || filebase.empty()) {
+            // not armed
+
+        } else if(!capturing) {
+            capturing = true;
+            captureEnd = end;
+            reopen = true;
+            epicsAtomicIncrSizeT(&ntrig);
+
+            epicsTimeStamp start(trigTime);
+            epicsTimeAddSeconds(&start, -trigPre);
+            trigExpire(done, start, vpoolTotal/2u);
+
+            if(PSCDebug>=1)
+                errlogPrintf("%s : trigger capture begins with %zu packets\n", name.c_str(), trigRing.size());
+
+        } else if(epicsTimeGreaterThan(&end, &captureEnd)) {
+            // re-trigger extends capture
+            captureEnd = end;
+        }
+    }
+
+    if(capturing && (!trigMode || !record)) {
+        capturing = false; // aborted
+
+    } else if(capturing) {
+        if(!trigRing.empty()) {
+            pkts_t staged;
+            staged.reserve(trigRing.size() + inprog.size());
+            for(size_t i=0, N=trigRing.size(); i<N; i++) {
+                staged.push_back(pkt());
+                staged.back().swap(trigRing[i]);
+            }
+            trigRing.clear();
+            for(size_t i=0, N=inprog.size(); i<N; i++) {
+                staged.push_back(pkt());
+                staged.back().swap(inprog[i]);
+            }
+            inprog.swap(staged);
+        }
+
+        // packets after the post-trigger window begin the next pre-trigger window
+        size_t n = inprog.size();
+        while(n && epicsTimeGreaterThan(&inprog[n-1u].rxtime, &captureEnd))
+            n--;
+        for(size_t i=n, N=inprog.size(); i<N; i++) {
+            trigRing.push_back(pkt());
+            trigRing.back().swap(inprog[i]);
+        }
+        inprog.resize(n);
+
+        // the last packets of the window have been written.  file will be closed
+        if(inprog.empty() && epicsTimeGreaterThan(&now, &captureEnd)) {
+            capturing = false;
+            if(PSCDebug>=1)
+                errlogPrintf("%s : trigger capture ends\n", name.c_str());
+        }
+    }
+
+    if(!capturing) {
+        if(trigMode) {
+            for(size_t i=0, N=inprog.size(); i<N; i++) {
+                trigRing.push_back(pkt());
+                trigRing.back().swap(inprog[i]);
+            }
+            inprog.clear();
+        }
+
+        epicsTimeStamp start(now);
+        epicsTimeAddSeconds(&start, -trigPre);
+        // leave half of the buffer pool for reception.
+        // When leaving triggered mode, release everything
+        trigExpire(done, start, trigMode ? vpoolTotal/2u : 0u);
+    }
+}
+
+void UDPFast::trigExpire(pkts_t& done, const epicsTimeStamp& oldest, size_t limit)
+{
+    while(!trigRing.empty() && (trigRing.size()>limit || epicsTimeLessThan(&trigRing.front().rxtime, &oldest))) {
+        done.push_back(pkt());
+        done.back().swap(trigRing.front());
+        trigRing.pop_front();
+    }
+}
+
+void UDPFast::sequence(pkts_t& inprog, pkts_t& ordered, pkts_t& done, bool idle)
+{
+    ordered.clear();
+    for(size_t i=0, N=inprog.size(); i<N; i++) {
+        pkt& pkt = inprog[i];
+
+        seqcheck_t::iterator it(seqCheck.find(pkt.msgid));
+        if(it==seqCheck.end() || pkt.bodylen < it->second.offset+4u) {
+            ordered.push_back(UDPFast::pkt());
+            ordered.back().swap(pkt);
+            continue;
+        }
+
+        const epicsUInt8 *S = reinterpret_cast<const epicsUInt8*>(&pkt.body[it->second.offset]);
+        epicsUInt32 seq = (epicsUInt32(S[0])<<24u) | (epicsUInt32(S[1])<<16u) | (epicsUInt32(S[2])<<8u) | S[3];
+
+        const size_t prevHeld = it->second.holding();
+        const bool keep = it->second.push(seq, pkt, ordered);
+        seqHeld = seqHeld - prevHeld + it->second.holding();
+
+        if(!keep) {
+            if(PSCDebug>=4)
+                errlogPrintf("%s : discard msgid %u seq %u\n", name.c_str(), pkt.msgid, unsigned(seq));
+            done.push_back(UDPFast::pkt());
+            done.back().swap(pkt);
+        }
+
+        if(seqHeld > vpoolMin/2u) {
+            // the windows of all msgids together may not starve the buffer pool.
+            // stop waiting on the one holding the most.
+            seqcheck_t::iterator worst(seqCheck.begin());
+            for(seqcheck_t::iterator it2(seqCheck.begin()), end(seqCheck.end()); it2!=end; ++it2) {
+                if(it2->second.holding() > worst->second.holding())
+                    worst = it2;
+            }
+            if(PSCDebug>=2)
+                errlogPrintf("%s : %zu held for reordering.  Flush msgid %u\n",
+                             name.c_str(), seqHeld, worst->first);
+            seqHeld -= worst->second.holding();
+            worst->second.flush(ordered);
+        }
+    }
+    if(idle) {
+        // sender is quiet, so stop waiting for missing packets
+        for(seqcheck_t::iterator it(seqCheck.begin()), end(seqCheck.end()); it!=end; ++it)
+            it->second.flush(ordered);
+        seqHeld = 0u;
+    }
+    // 'inprog' now has only emptied entries
+    inprog.swap(ordered);
+    ordered.clear();
+}
+
+void UDPFast::setRecvSequence(epicsUInt16 block, epicsUInt32 offset, epicsUInt32 window)
+{
+    if(seqCheck.find(block)!=seqCheck.end())
+        throw std::runtime_error("Sequence checking already enabled");
+    // prevent reordering past a full buffer pool
+    if(window >= vpoolTotal/2u)
+        throw std::runtime_error("Reorder window too large for buffer pool");
+    Block *blk = getRecv(block);
+    seqCheck.insert(std::make_pair(block, seqwindow_t(blk, offset, window)));
+}
+
 void UDPFast::cachefn()
 {
+    pscThreadApply("udpfc", name.c_str());
+
     if(PSCDebug>=2)
         errlogPrintf("%s : cache worker starts\n", name.c_str());
 
     PTimer timewritev("writev()"),
            timedsync("fdatasync()"),
+           timepace("sync_file_range()"),
            timeopen("open()"),
            timeclose("close()");
     epicsUInt64 filetotal = 0u;
+    epicsUInt64 unsynced = 0u;
+    epicsUInt64 accounted = 0u; // writer->offset already added to filetotal
 
     DataFD datafile;
+    FileIndex index(name);
+    index.everyPkts = std::max(0, PSCUDPIndexPackets);
+    index.everySec = PSCUDPIndexPeriod;
 
-    struct header_t {
-        const char P, S;
-        epicsUInt16 msgid;
-        epicsUInt32 bodylen;
-        epicsUInt32 sec;
-        epicsUInt32 nsec;
-        header_t() :P('P'), S('S') {}
-    };
-    std::vector<iovec> ios(iovLimit); // round down to multiple of 2
-    std::vector<header_t> headers(ios.size()/2u);
+    psc::auto_ptr<DataWriter> writer;
+    DataWriter::Config conf;
+    {
+        conf.iovLimit = iovLimit;
+        conf.uringDepth = std::max(0, PSCUDPURingDepth);
+        conf.directBuf = size_t(std::max(0, PSCUDPDirectIOMB))<<20u;
+        conf.compressLevel = PSCUDPCompressLevel;
+        conf.compressThreads = std::max(1, PSCUDPCompressThreads);
+        conf.compressIn = &compin;
+        conf.compressOut = &compout;
+        writer.reset(DataWriter::create(name, conf));
+        if(index.enabled())
+            writer->index = &index;
+    }
+    // optionally, prepare next data file in advance
+    psc::auto_ptr<FileRotator> rotator;
+    if(PSCUDPPreAlloc)
+        rotator.reset(new FileRotator(name));
+
+    WritebackPacer pacer;
+    pacer.chunk = epicsUInt64(std::max(0, PSCUDPWritebackMB))<<20u;
+
+    // striped recording, when FileDir lists more than one directory.
+    std::vector<StripeWriter*> stripes;
+    bool stripeOpen = false;
+    epicsUInt64 chunkSeq = 0u;
+    epicsUInt64 chunkFill = 0u; // bytes in current chunk
+    bool chunkStart = true;
+    const epicsUInt64 chunkSize = epicsUInt64(std::max(1, PSCUDPStripeChunkMB))<<20u;
 
     pkts_t inprog;
+    pkts_t ordered; // scratch for sequence()
+    vecs_t spare; // buffers given up by Blocks.  See PSCUDPZeroCopyCache
+    std::vector<char> adoptable; // [i] if inprog[i] is not wanted by its short buffer.  See PSCUDPZeroCopyCache
+    pkts_t done; // buffers released by 'writer'
     {
         Guard R(rxLock);
         inprog.reserve(pending.capacity());
+        done.reserve(pending.capacity());
+        ordered.reserve(pending.capacity());
+        spare.reserve(pending.capacity());
         // our 'inprog' and 'pending' are swap()'d as two parts of a double buffering scheme
     }
 
@@ -458,40 +1335,44 @@ void UDPFast::cachefn()
 
     while(true) {
         epicsTimeStamp now;
+        int fileerr = 0;
+        // wake periodically to expire the trigger ring, end captures,
+        // and release packets held for reordering
+        bool poll = trigMode || !trigRing.empty();
+        poll |= seqHeld!=0u;
+        // and to shrink vpool when quiet
+        poll |= vpoolTotal > vpoolMin;
         {
             UnGuard U(G);
 
-            // de-assign
-            bool unstall = false;
-            if(!inprog.empty()) {
-                Guard R(rxLock);
-
-                unstall = vpool.empty();
-
-                for(size_t i=0, N=inprog.size(); i<N; i++) {
-                    pkt& pkt = inprog[i];
+            const bool run = epics::atomic::get(running);
 
-                    if(!pkt.body.empty()) {
-                        vpool.push_back(vecs_t::value_type()); // shouldn't need to (re)allocate
-                        vpool.back().swap(pkt.body);
-                        if(PSCDebug>=5)
-                            errlogPrintf("%s : return consumed %zu\n", name.c_str(), i);
-                    }
-                }
-                inprog.clear();
-
-                unstall &= !vpool.empty();
+            // de-assign
+            if(writer->busy()) {
+                // when stopping, wait for all in flight writes
+                fileerr = writer->reap(done, !run);
             }
-            if(unstall) {
-                if(PSCDebug>=1)
-                    errlogPrintf("%s : vpool stall resume\n", name.c_str());
-                vpoolStall.signal();
+            bool stripesBusy = false;
+            for(size_t s=0; s<stripes.size(); s++) {
+                if(int err = stripes[s]->reap(done))
+                    fileerr = err;
+                stripesBusy |= stripes[s]->busy();
             }
+            recycle(done);
+            recycle(inprog);
+            resizePool();
 
-            if(!epics::atomic::get(running))
+            if(!run)
                 break;
 
-            pendingReady.wait();
+            if(writer->busy() || stripesBusy) {
+                // poll for completions while writes are in flight
+                (void)pendingReady.wait(0.01);
+            } else if(poll) {
+                (void)pendingReady.wait(0.1);
+            } else {
+                pendingReady.wait();
+            }
             epicsTimeGetCurrent(&now);
 
             {
@@ -504,13 +1385,57 @@ void UDPFast::cachefn()
         if(PSCDebug>=5)
             errlogPrintf("%s : consuming %zu\n", name.c_str(), inprog.size());
 
-        if(!record && datafile.isOpen()) { // close current file
+        if(!seqCheck.empty())
+            sequence(inprog, ordered, done, inprog.empty());
+
+        if(shm && !inprog.empty()) {
+            // live fan-out of all packets, before the cache may take their buffers
+            UnGuard U(G);
+            for(size_t i=0, N=inprog.size(); i<N; i++) {
+                FileRecordHeader H;
+                H.fill(inprog[i]);
+                (void)shm->publish(&H, &inprog[i].body[0], inprog[i].bodylen);
+            }
+            shm->commit();
+        }
+
+        if((!record || fileerr || (trigMode && !capturing)) && datafile.isOpen()) { // close current file
+            UnGuard U(G);
+            (void)writer->reap(done, true);
+            if(!fileerr)
+                fileerr = writer->finish();
+            if(!fileerr)
+                fileerr = pacer.finish(datafile.fd, writer->offset);
+            index.close();
             timeclose.start();
-            datafile.close();
+            if(rotator.get())
+                rotator->retire(datafile.release(), writer->offset);
+            else
+                datafile.close();
             timeclose.stop();
             if(PSCDebug>=1)
                 errlogPrintf("%s : closed \"%s\"\n", name.c_str(), lastfile.c_str());
         }
+        if((!record || fileerr || (trigMode && !capturing)) && stripeOpen) { // close current stripe set
+            for(size_t s=0; s<stripes.size(); s++)
+                stripes[s]->close();
+            stripeOpen = false;
+        }
+        if(fileerr)
+            record = false;
+
+        // When nothing after the cache needs packet bodies (not recording, no trigger,
+        // short buffer of this msgid full), Blocks take the packet buffer,
+        // and give their previous buffer back to vpool.
+        const bool zerocopy = PSCUDPZeroCopyCache && !record && !trigMode && !capturing && trigRing.empty();
+        if(zerocopy) {
+            adoptable.assign(inprog.size(), 1);
+            Guard S(shortLock);
+            for(size_t i=0, N=inprog.size(); i<N && shortRoom; i++) {
+                const ShortRing *ring = shortIndex[inprog[i].msgid];
+                adoptable[i] = !ring || ring->pkts.size() >= ring->limit;
+            }
+        }
 
         for(size_t i=0, N=inprog.size(); i<N; i++) {
             pkt& pkt = inprog[i];
@@ -524,51 +1449,238 @@ void UDPFast::cachefn()
                 blk->count++;
                 blk->rxtime = pkt.rxtime;
 
-                blk->data.assign(&pkt.body[0], pkt.body.size());
+                if(zerocopy && adoptable[i]) {
+                    blk->data.adopt(pkt.body);
+                    // first time for this Block, replace with a new buffer
+                    if(pkt.body.size()!=vpoolBufSize)
+                        pkt.body.resize(vpoolBufSize);
+                    spare.push_back(vecs_t::value_type());
+                    spare.back().swap(pkt.body);
+                } else {
+                    blk->data.assign(&pkt.body[0], pkt.body.size());
+                }
 
                 blk->requestScan();
                 blk->listeners(blk);
             }
         }
+        if(!inprog.empty()) {
+            epicsTimeStamp cached;
+            epicsTimeGetCurrent(&cached);
+            latCache.add(epicsTimeDiffInSeconds(&cached, &inprog.front().rxtime));
+
+            // kernel timestamps are CLOCK_REALTIME, which the EPICS time provider need not follow
+            epicsTimeStamp realnow = {0u, 0u};
+            timespec ts;
+            if(PSCUDPRxTimestamp && clock_gettime(CLOCK_REALTIME, &ts)==0)
+                (void)epicsTimeFromTimespec(&realnow, &ts);
+
+            for(size_t i=0, N=inprog.size(); realnow.secPastEpoch && i<N; i++) {
+                const epicsTimeStamp& kt = inprog[i].kerntime;
+                if(!kt.secPastEpoch)
+                    continue; // no kernel timestamp
+                double lat = epicsTimeDiffInSeconds(&realnow, &kt);
+                latRx.add(lat);
+
+                size_t bucket = 0u;
+                for(double us = lat*1e6; us>=2.0 && bucket+1u<rxLatHistSize; us/=2.0)
+                    bucket++;
+                epicsAtomicIncrSizeT(&rxLatHist[bucket]);
+            }
+        }
+
+        if(!spare.empty()) {
+            // drop packets now owned by Blocks
+            size_t keep = 0u;
+            for(size_t i=0, N=inprog.size(); i<N; i++) {
+                if(inprog[i].body.empty())
+                    continue;
+                if(i!=keep)
+                    inprog[keep].swap(inprog[i]);
+                keep++;
+            }
+            inprog.resize(keep);
 
+            bool unstall;
+            {
+                Guard R(rxLock);
+                unstall = vpool.empty();
+                for(size_t i=0, N=spare.size(); i<N; i++) {
+                    vpool.push_back(vecs_t::value_type());
+                    vpool.back().swap(spare[i]);
+                }
+            }
+            spare.clear();
+            if(unstall)
+                vpoolStall.signal();
+        }
+
+        if(trigMode || capturing || !trigRing.empty())
+            triggered(inprog, done, now);
+
+        if(record && !recPolicy.empty()) {
+            // drop packets which are not to be recorded.  They are recycled with 'done'
+            size_t keep = 0u;
+            const size_t N = inprog.size();
+            for(size_t i=0; i<N; i++) {
+                policy_map::iterator it(recPolicy.find(inprog[i].msgid));
+                if(it!=recPolicy.end() && !it->second.accept(inprog[i]))
+                    continue;
+                if(i!=keep)
+                    inprog[keep].swap(inprog[i]);
+                keep++;
+            }
+            for(size_t i=keep; i<N; i++) {
+                done.push_back(pkt());
+                done.back().swap(inprog[i]);
+            }
+            inprog.resize(keep);
+            epicsAtomicAddSizeT(&nfiltered, N-keep);
+        }
 
-        if(inprog.empty())
+        if(inprog.empty()) {
+            if(fileerr) {
+                std::ostringstream strm;
+                strm<<"("<<fileerr<<") "<<strerror(fileerr);
+                lasterror = strm.str();
+            }
             continue;
+        }
 
         if(datafile.isOpen() && filetotal>=size_t(PSCUDPMaxLenMB*(1u<<20u))) {
             reopen = true;
             if(PSCDebug>=2)
                 errlogPrintf("%s : rotate data file for size=%zu\n", name.c_str(), size_t(filetotal));
+        } else if(stripeOpen && filetotal>=size_t(PSCUDPMaxLenMB*(1u<<20u))*stripes.size()) {
+            reopen = true;
+            if(PSCDebug>=2)
+                errlogPrintf("%s : rotate stripe set for size=%zu\n", name.c_str(), size_t(filetotal));
         }
 
-        int fileerr = 0;
+        std::vector<std::string> stripedirs;
+        if(record && reopen)
+            splitDirs(filedir, stripedirs);
+
+        if(record && reopen && !filebase.empty() && (!trigMode || capturing) && stripedirs.size()>1) { // open new stripe set
+            reopen = false;
+            filetotal = 0u;
+            chunkSeq = chunkFill = 0u;
+            chunkStart = true;
+            const std::string base(filebase);
+
+            UnGuard U(G);
+
+            char tsbuf[25];
+            epicsTimeToStrftime(tsbuf, sizeof(tsbuf), "%Y%m%d-%H%M%S", &now);
+
+            if(datafile.isOpen()) {
+                // previously recording to a single directory
+                (void)writer->reap(done, true);
+                fileerr = writer->finish();
+                if(!fileerr)
+                    fileerr = pacer.finish(datafile.fd, writer->offset);
+                index.close();
+                if(rotator.get())
+                    rotator->retire(datafile.release(), writer->offset);
+                else
+                    datafile.close();
+            }
+
+            if(stripes.size()!=stripedirs.size()) {
+                destroyStripes(stripes, done);
+
+                StripeWriter::Config sconf;
+                sconf.writer = conf;
+                sconf.indexPkts = index.everyPkts;
+                sconf.indexSec = index.everySec;
+                sconf.paceChunk = pacer.chunk;
+                sconf.syncSize = epicsUInt64(std::max(0, PSCUDPDSyncSizeMB))<<20u;
+                sconf.wrote = &storewrote;
+
+                for(size_t s=0; s<stripedirs.size(); s++) {
+                    std::ostringstream strm;
+                    strm<<name<<":s"<<s;
+                    stripes.push_back(new StripeWriter(strm.str(), s, stripedirs.size(), sconf));
+                }
+            }
 
-        if(record && reopen && !filebase.empty()) { // open new file
+            // each stripe opens its file.  Errors are reported through reap()
+            for(size_t s=0; s<stripes.size(); s++) {
+                std::ostringstream namestrm;
+                namestrm<<stripedirs[s]<<OSI_PATH_SEPARATOR<<base<<tsbuf<<"-s"<<s<<stripes[s]->extension();
+                stripes[s]->open(namestrm.str());
+                if(s==0u)
+                    lastfile = namestrm.str();
+            }
+            stripeOpen = true;
+            if(PSCDebug>=1)
+                errlogPrintf("%s : opened stripe set \"%s\" of %zu\n", name.c_str(), lastfile.c_str(), stripes.size());
+        }
+
+        if(record && reopen && !filebase.empty() && (!trigMode || capturing)) { // open new file
             reopen = false;
             filetotal = 0u;
+            unsynced = 0u;
 
             std::ostringstream namestrm;
 
-            if(!filedir.empty()) {
-                namestrm << filedir << OSI_PATH_SEPARATOR;
+            if(!stripedirs.empty()) {
+                namestrm << stripedirs[0] << OSI_PATH_SEPARATOR;
             }
 
             namestrm << filebase;
+            const std::string prefix(namestrm.str());
 
             UnGuard U(G);
 
             char tsbuf[25];
             epicsTimeToStrftime(tsbuf, sizeof(tsbuf), "%Y%m%d-%H%M%S", &now);
 
-            namestrm << tsbuf << ".dat";
+            namestrm << tsbuf << writer->extension();
             std::string fname = namestrm.str();
 
+            // previous file must be complete before close()
+            if(datafile.isOpen()) {
+                (void)writer->reap(done, true);
+                fileerr = writer->finish();
+                if(!fileerr)
+                    fileerr = pacer.finish(datafile.fd, writer->offset);
+                index.close();
+            }
+            if(stripeOpen) {
+                // previously recording to several directories
+                for(size_t s=0; s<stripes.size(); s++)
+                    stripes[s]->close();
+                stripeOpen = false;
+            }
+
+            std::string sparename;
+            int sparefd = -1;
+            if(rotator.get())
+                sparefd = rotator->take(prefix, writer->openFlags(), sparename);
+
             timeclose.start();
-            datafile.close();
+            if(rotator.get() && datafile.isOpen())
+                rotator->retire(datafile.release(), writer->offset);
+            else
+                datafile.close();
             timeclose.stop();
 
             timeopen.start();
-            datafile.fd = ::open(fname.c_str(), O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+            if(sparefd>=0) {
+                // rename in background
+                datafile.fd = sparefd;
+                rotator->rename(sparename, fname);
+
+            } else {
+                const int oflags = O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC;
+                datafile.fd = ::open(fname.c_str(), oflags|writer->openFlags(), 0644);
+                if(!datafile.isOpen() && errno==EINVAL && writer->openFlags()) {
+                    // eg. O_DIRECT not supported by this filesystem
+                    errlogPrintf("%s : \"%s\" rejects special open flags.  Retry without\n", name.c_str(), fname.c_str());
+                    datafile.fd = ::open(fname.c_str(), oflags, 0644);
+                }
+            }
             timeopen.stop();
             if(!datafile.isOpen()) {
                 fileerr = errno;
@@ -580,79 +1692,79 @@ void UDPFast::cachefn()
                 if(PSCDebug>=1)
                     errlogPrintf("%s : opened \"%s\"\n", name.c_str(), fname.c_str());
                 lastfile = fname;
+                writer->open(datafile.fd);
+                accounted = 0u;
+                pacer.open();
+                if(index.enabled())
+                    (void)index.open(fname+".idx");
+
+                if(rotator.get())
+                    rotator->prepare(prefix, writer->openFlags(), epicsUInt64(PSCUDPMaxLenMB*(1u<<20u)));
             }
 
         }
 
+        double writeTime = -1.0; // sec.  <0 when nothing written
         {
             UnGuard U(G);
 
             if(datafile.isOpen()) {
 
                 epicsUInt64 tstart = epicsMonotonicGet();
-                size_t datatotal = 0u;
 
-                // iterate inprog and write in batches
                 timewritev.start();
-                for(size_t i=0, N=inprog.size(); i<N && datafile.isOpen();) {
-                    size_t batchtotal = 0u;
-                    size_t b, B;
-
-                    for(b=0, B=headers.size(); i<N && b<B; i++, b++) {
-                        auto& pkt = inprog[i];
-                        auto& H = headers[b];
-                        auto& IOhead = ios[2*b+0];
-                        auto& IObody = ios[2*b+1];
-
-                        H.msgid = htons(pkt.msgid);
-                        H.bodylen = htonl(pkt.bodylen);
-                        H.sec = htonl(pkt.rxtime.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH);
-                        H.nsec = htonl(pkt.rxtime.nsec);
-
-                        IOhead.iov_base = &H;
-                        IOhead.iov_len = sizeof(header_t);
-                        IObody.iov_base = &pkt.body[0];
-                        IObody.iov_len = pkt.bodylen;
-                        batchtotal += sizeof(header_t) + pkt.bodylen;
-                    }
-
-                    ssize_t ret = writev(datafile.fd, &ios[0], 2*b);
-                    if(ret<0) {
-                        fileerr = errno;
-                        if(PSCDebug>=0)
-                            errlogPrintf("%s : data file write error: (%d) %s\n", name.c_str(), fileerr, strerror(fileerr));
-                        datafile.close();
-                        record = false;
+                // may take buffers from inprog
+                int err = writer->submit(inprog);
+                timewritev.stop();
 
-                    } else if(size_t(ret)!=batchtotal) {
-                        if(PSCDebug>=0)
-                            errlogPrintf("%s : data file write incomplete %zd of %zu\n", name.c_str(), ret, batchtotal);
+                // includes any earlier submit() completed by reap()
+                const size_t datatotal = writer->offset - accounted;
+                accounted = writer->offset;
+
+                if(err) {
+                    fileerr = err;
+                    (void)writer->reap(done, true);
+                    index.close();
+                    if(rotator.get())
+                        rotator->retire(datafile.release(), writer->offset);
+                    else
                         datafile.close();
-                        record = false;
-                    }
-
-                    datatotal += batchtotal;
+                    record = false;
+                } else {
+                    (void)index.flush();
                 }
-                timewritev.stop();
 
                 epicsAtomicAddSizeT(&storewrote, datatotal);
                 filetotal += datatotal;
+                unsynced += datatotal;
                 epicsAtomicSetSizeT(&lastsize, filetotal);
 
-                if(PSCUDPDSyncSizeMB && datafile.isOpen() && filetotal/(1u<<20u) >= size_t(PSCUDPDSyncSizeMB)) {
-                    filetotal = 0u;
+                if(PSCUDPDSyncSizeMB && datafile.isOpen() && unsynced/(1u<<20u) >= size_t(PSCUDPDSyncSizeMB)) {
+                    unsynced = 0u;
                     if(PSCDebug>1)
                         errlogPrintf("%s : periodic flush\n", name.c_str());
                     timedsync.start();
-                    int ret = fdatasync(datafile.fd);
+                    int ret = writer->sync();
                     timedsync.stop();
                     if(ret) {
-                        fileerr = errno;
+                        fileerr = ret;
                         errlogPrintf("%s : fdatasync error %s (%d)", name.c_str(), strerror(fileerr), fileerr);
                     }
                 }
 
+                if(pacer.chunk && datafile.isOpen()) {
+                    timepace.start();
+                    // only ranges already written.  eg. not still in flight with io_uring
+                    int ret = pacer.update(datafile.fd, writer->completed());
+                    timepace.stop();
+                    if(ret) {
+                        fileerr = ret;
+                        errlogPrintf("%s : writeback error %s (%d)\n", name.c_str(), strerror(fileerr), fileerr);
+                    }
+                }
+
                 epicsUInt64 tend = epicsMonotonicGet();
+                writeTime = (tend-tstart)/1e9;
                 if(PSCDebug>=3) {
                     double ellapsed = (tend-tstart)/1e9; // sec
                     if(finite(ellapsed) && ellapsed>0.0) {
@@ -663,55 +1775,362 @@ void UDPFast::cachefn()
                     }
                 }
 
-            }
-
-            {
-                Guard S(shortLock);
-                const size_t istart = shortBuf.size();
-                if(const size_t nmove = std::min(inprog.size(), shortLimit - istart)) {
-
-                    shortBuf.resize(istart + nmove);
-
-                    std::swap_ranges(shortBuf.begin()+istart,
-                                     shortBuf.end(),
-                                     inprog.begin());
+            } else if(stripeOpen) {
+                // deal out consecutive chunks round-robin.  Stripes take all buffers.
+                const size_t N = inprog.size();
+                size_t begin = 0u;
+                epicsUInt64 queued = 0u;
+                for(size_t i=0; i<N; i++) {
+                    if(chunkFill >= chunkSize) {
+                        if(i>begin)
+                            stripes[chunkSeq%stripes.size()]->queue(inprog, begin, i, chunkStart, chunkSeq);
+                        begin = i;
+                        chunkSeq++;
+                        chunkFill = 0u;
+                        chunkStart = true;
+                    }
+                    const size_t len = sizeof(FileRecordHeader) + inprog[i].bodylen;
+                    chunkFill += len;
+                    queued += len;
+                }
+                if(N>begin) {
+                    stripes[chunkSeq%stripes.size()]->queue(inprog, begin, N, chunkStart, chunkSeq);
+                    chunkStart = false;
                 }
+
+                filetotal += queued;
+                epicsAtomicSetSizeT(&lastsize, filetotal);
             }
 
         } // re-locked
 
+        if(writeTime>=0.0)
+            latWrite.add(writeTime);
+
         if(fileerr) {
             std::ostringstream strm;
             strm<<"("<<fileerr<<") "<<strerror(fileerr);
             lasterror = strm.str();
         }
+        if(rotator.get()) {
+            std::string msg(rotator->lastError());
+            if(!msg.empty())
+                lasterror = msg;
+            // data remains under the temporary name
+            std::string from, to;
+            if(rotator->failedRename(from, to) && lastfile==to)
+                lastfile = from;
+        }
+    }
+
+    if(!seqCheck.empty()) {
+        for(seqcheck_t::iterator it(seqCheck.begin()), end(seqCheck.end()); it!=end; ++it)
+            it->second.flush(done);
+        seqHeld = 0u;
+        UnGuard U(G);
+        recycle(done);
+    }
+
+    if(!trigRing.empty()) {
+        epicsTimeStamp never = {0u, 0u};
+        trigExpire(done, never, 0u);
+        UnGuard U(G);
+        recycle(done);
+    }
+
+    if(datafile.isOpen()) {
+        // complete any buffered writes
+        UnGuard U(G);
+        (void)writer->reap(done, true);
+        int err = writer->finish();
+        if(err)
+            errlogPrintf("%s : error completing \"%s\" : (%d) %s\n",
+                         name.c_str(), lastfile.c_str(), err, strerror(err));
+        (void)pacer.finish(datafile.fd, writer->offset);
+        index.close();
+        if(rotator.get())
+            rotator->retire(datafile.release(), writer->offset);
+        else
+            datafile.close();
+        recycle(done);
+    }
+
+    if(!stripes.empty()) {
+        UnGuard U(G);
+        destroyStripes(stripes, done);
+        recycle(done);
     }
 
     if(PSCDebug>=2)
         errlogPrintf("%s : cache worker ends\n", name.c_str());
 }
 
+void UDPFast::setRecordPolicy(const std::string& spec, bool replace)
+{
+    policy_map temp;
+    if(!replace) {
+        Guard G(lock);
+        temp = recPolicy;
+    }
+
+    std::string norm(spec);
+    std::replace(norm.begin(), norm.end(), ',', ' ');
+    std::istringstream strm(norm);
+    std::string item;
+
+    while(strm >> item) {
+        if(item=="clear") {
+            temp.clear();
+            continue;
+        }
+
+        size_t sep = item.find('=');
+        char *end = 0;
+        unsigned long msgid = strtoul(item.c_str(), &end, 0);
+        if(sep==std::string::npos || sep==0u || end!=item.c_str()+sep || msgid>0xffff)
+            throw std::runtime_error("Expected <msgid>=<policy>, not '"+item+"'");
+
+        std::string policy(item.substr(sep+1u));
+        RecordPolicy P;
+        double arg = 0.0;
+
+        if(policy=="all") {
+            temp.erase(msgid);
+            continue;
+
+        } else if(policy=="none") {
+            P.kind = RecordPolicy::None;
+
+        } else if(policy.compare(0, 6, "every:")==0 && epicsParseUInt32(policy.c_str()+6, &P.every, 0, 0)==0
+                  && P.every>0u) {
+            P.kind = RecordPolicy::Every;
+
+        } else if(policy.compare(0, 3, "hz:")==0 && epicsParseDouble(policy.c_str()+3, &arg, 0)==0
+                  && arg>0.0) {
+            P.kind = RecordPolicy::Rate;
+            P.period = 1.0/arg;
+
+        } else {
+            throw std::runtime_error("Unknown record policy '"+policy+"' for msgid "+item.substr(0, sep));
+        }
+
+        temp[msgid] = P;
+    }
+
+    Guard G(lock);
+    recPolicy.swap(temp);
+}
+
+std::vector<char>& UDPFast::queueHeader(Block *blk, epicsUInt32 buflen)
+{
+    if(replaySrc)
+        throw std::runtime_error("Replay does not transmit");
+
+    {
+        Guard T(txLock);
+        if(txFree.empty())
+            throw std::runtime_error("UDPFast send queue limit exceeded");
+        txQueued.push_back(TXMsg());
+        std::swap(txQueued.back(), txFree.back());
+        txFree.pop_back();
+    }
+    TXMsg& msg = txQueued.back();
+
+    // send to the peer whose msgid range includes this Block.  See addPeer()
+    msg.peer = 0u;
+    for(size_t i=1; i<peers.size(); i++) {
+        if(peers[i].msgbase<=blk->code && peers[i].msgbase>peers[msg.peer].msgbase)
+            msg.peer = i;
+    }
+    const epicsUInt16 msgid = epicsUInt16(blk->code - peers[msg.peer].msgbase);
+
+    std::vector<char>& scratch = msg.buf;
+    scratch.resize(8u + buflen);
+
+    scratch[0] = 'P';
+    scratch[1] = 'S';
+    *(epicsUInt16*)(&scratch[2]) = htons(msgid);
+    *(epicsUInt32*)(&scratch[4]) = htonl(buflen);
+    return scratch;
+}
+
+void UDPFast::queueSend(epicsUInt16 id, const void* buf, epicsUInt32 buflen)
+{
+    Block *blk = getSend(id);
+    queueSend(blk, buf, buflen);
+}
+
+void UDPFast::queueSend(Block* blk, const dbuffer& buf)
+{
+    std::vector<char>& scratch = queueHeader(blk, buf.size());
+
+    buf.copyout(&scratch[8], 0, buf.size());
+
+    blk->queued = true;
+    blk->count++;
+
+    if(PSCDebug>1)
+        timefprintf(stderr, "%s: enqueued block %u %lu bytes\n",
+                name.c_str(), blk->code, (unsigned long)buf.size());
+}
+
+void UDPFast::queueSend(Block* blk, const void* buf, epicsUInt32 buflen)
+{
+    std::vector<char>& scratch = queueHeader(blk, buflen);
+
+    memcpy(&scratch[8], buf, buflen);
+
+    blk->queued = true;
+    blk->count++;
+
+    if(PSCDebug>1)
+        timefprintf(stderr, "%s: enqueue block %u %lu bytes\n",
+                name.c_str(), blk->code, (unsigned long)buflen);
+}
+
+void UDPFast::flushSend()
+{
+    if(!connected)
+        return;
+    if(PSCDebug>1)
+        timefprintf(stderr, "%s: flush %u\n",
+                    name.c_str(), (unsigned)txQueued.size());
+
+    {
+        Guard T(txLock);
+        for(size_t i=0; i<txQueued.size(); i++) {
+            txReady.push_back(TXMsg());
+            std::swap(txReady.back(), txQueued[i]);
+        }
+    }
+    txQueued.clear();
+
+    for(block_map::const_iterator it = send_blocks.begin(), end = send_blocks.end();
+        it!=end; ++it)
+    {
+        it->second->queued = false;
+    }
+
+    txWakeup.signal();
+}
+
+void UDPFast::txfn()
+{
+    pscThreadApply("udpftx", name.c_str());
+
+    if(PSCDebug>=2)
+        errlogPrintf("%s : tx worker starts\n", name.c_str());
+
+    txmsgs_t sending;
+    std::vector<mmsghdr> headers;
+    std::vector<iovec> io;
+
+    Guard G(txLock);
+    sending.reserve(txFree.size() + txReady.size());
+
+    while(epics::atomic::get(running)) {
+        if(txReady.empty()) {
+            UnGuard U(G);
+            txWakeup.wait();
+            continue;
+        }
+
+        sending.swap(txReady);
+        const size_t nsend = sending.size();
+        size_t nerr = 0u;
+        {
+            UnGuard U(G);
+
+            if(headers.size() < nsend) {
+                headers.resize(nsend);
+                io.resize(nsend);
+            }
+
+            for(size_t i=0; i<nsend; i++) {
+                msghdr& hdr = headers[i].msg_hdr;
+                memset(&hdr, 0, sizeof(hdr));
+                io[i].iov_base = &sending[i].buf[0];
+                io[i].iov_len = sending[i].buf.size();
+                hdr.msg_name = (void*)&peers[sending[i].peer].addr.ia;
+                hdr.msg_namelen = sizeof(peers[sending[i].peer].addr.ia);
+                hdr.msg_iov = &io[i];
+                hdr.msg_iovlen = 1u;
+            }
+
+            // sendmmsg() stops at the first error, which is returned by the next call
+            for(size_t off = 0u; off < nsend; ) {
+                int ret = sendmmsg(sock, &headers[off], nsend-off, 0);
+                if(ret<0 && errno==EINTR) {
+                    continue;
+
+                } else if(ret<0) {
+                    int err = errno;
+                    if(PSCDebug>=0)
+                        errlogPrintf("%s : sendmmsg() error (%d) %s\n", name.c_str(), err, strerror(err));
+                    nerr++; // skip the failed message
+                    off++;
+
+                } else {
+                    if(PSCDebug>=4)
+                        errlogPrintf("%s : sendmmsg() -> %d of %zu\n", name.c_str(), ret, nsend-off);
+                    off += size_t(ret);
+                }
+            }
+        }
+
+        epicsAtomicAddSizeT(&ntx, nsend-nerr);
+        epicsAtomicAddSizeT(&ntxerr, nerr);
+
+        for(size_t i=0; i<nsend; i++) {
+            txFree.push_back(TXMsg());
+            std::swap(txFree.back(), sending[i]);
+        }
+        sending.clear();
+    }
+
+    if(PSCDebug>=2)
+        errlogPrintf("%s : tx worker ends\n", name.c_str());
+}
+
+void UDPFast::joinMulticast(const std::string& group, const std::string& iface)
+{
+    if(replaySrc)
+        throw std::runtime_error("Replay does not receive");
+    if(!mcastGroup.empty())
+        throw std::runtime_error("Already joined "+mcastGroup);
+
+    // source specific, once for each peer.  Peers added later also join.
+    for(size_t i=0; i<peers.size(); i++) {
+        if(int err = pscJoinMulticast(sock, group.c_str(), iface.c_str(), &peers[i].addr.ia))
+            throw std::runtime_error("Unable to join "+group+" for '"+peers[i].label+"' : "+strerror(err));
+    }
+    mcastGroup = group;
+    mcastIface = iface;
+    printf("  joined multicast group %s\n", group.c_str());
+}
+
 void UDPFast::connect()
 {
     connected = true;
     rxworker.start();
     cacheworker.start();
+    txworker.start();
 }
 
 void UDPFast::stop()
 {
     connected = false;
     epics::atomic::set(running, 0);
-    {
-        // send a zero length packet to myself to wake rxworker
-        char junk = 0;
-        if(sendto(sock, &junk, 0, 0, &self.sa, sizeof(self))<0)
-            errlogPrintf("%s : error waking rxworker\n", name.c_str());
-    }
+    // wake rxworker.  A zero length packet sent to myself would be dropped by attachFilter().
+    // Linux wakes blocked receivers even though an unconnected UDP socket gives ENOTCONN.
+    if(shutdown(sock, SHUT_RD) && SOCKERRNO!=SOCK_ENOTCONN)
+        errlogPrintf("%s : error waking rxworker\n", name.c_str());
     vpoolStall.signal();
     pendingReady.signal(); // wake cacheworker
+    txWakeup.signal();
     rxworker.exitWait();
     cacheworker.exitWait();
+    txworker.exitWait();
 }
 
 namespace {
@@ -726,6 +2145,74 @@ void createPSCUDPFast(const char* name, const char* host, int hostport, int ifac
     }
 }
 
+void createPSCUDPFastReplay(const char* name, const char* fname, double speed)
+{
+    try {
+        if(!name || !fname)
+            throw std::runtime_error("Usage: createPSCUDPFastReplay(\"name\", \"file.dat\", speed)");
+
+        psc::auto_ptr<UDPDataFile> src(new UDPDataFile(fname));
+        // socket is not used
+        UDPFast *dev = new UDPFast(name, "127.0.0.1", 0, 0);
+        dev->replaySpeed = speed;
+        dev->replaySrc = src.release();
+    }catch(std::exception& e){
+        iocshSetError(1);
+        fprintf(stderr, "Error: %s\n", e.what());
+    }
+}
+
+void addPSCUDPFastPeer(const char* name, const char* label, const char* host, int port, int msgbase)
+{
+    try {
+        if(!name || !label || !host)
+            throw std::runtime_error("Usage: addPSCUDPFastPeer(\"name\", \"label\", \"hostname\", hostport#, msgidbase)");
+        if(port<0 || port>0xffff || msgbase<0 || msgbase>0xffff)
+            throw std::runtime_error("port and msgid base must be in range [0, 65535]");
+        UDPFast *dev = PSCBase::getPSC<UDPFast>(name);
+        if(!dev)
+            throw std::runtime_error("Unknown PSCUDPFast");
+        dev->addPeer(label, host, port, msgbase);
+    }catch(std::exception& e){
+        iocshSetError(1);
+        fprintf(stderr, "Error: %s\n", e.what());
+    }
+}
+
+void setPSCUDPFastShm(const char* name, const char* shmname, double sizeMB)
+{
+    try {
+        if(!name || !shmname || shmname[0]!='/')
+            throw std::runtime_error("Usage: setPSCUDPFastShm(\"name\", \"/shmname\", sizeMB)");
+        if(!(sizeMB>0.0 && sizeMB<=4096.0))
+            throw std::runtime_error("size must be in range (0, 4096] MB");
+        UDPFast *dev = PSCBase::getPSC<UDPFast>(name);
+        if(!dev)
+            throw std::runtime_error("Unknown PSCUDPFast");
+        if(dev->isConnected())
+            throw std::runtime_error("Shared memory must be set before iocInit()");
+        psc::auto_ptr<UDPShmWriter> shm(new UDPShmWriter(shmname, size_t(sizeMB*1024*1024)));
+        delete dev->shm;
+        dev->shm = shm.release();
+    }catch(std::exception& e){
+        iocshSetError(1);
+        fprintf(stderr, "Error: %s\n", e.what());
+    }
+}
+
+void setPSCUDPRecordPolicy(const char* name, const char* spec)
+{
+    try {
+        UDPFast *dev = PSCBase::getPSC<UDPFast>(name ? name : "");
+        if(!dev)
+            throw std::runtime_error("Unknown PSCUDPFast");
+        dev->setRecordPolicy(spec ? spec : "", false);
+    }catch(std::exception& e){
+        iocshSetError(1);
+        fprintf(stderr, "Error: %s\n", e.what());
+    }
+}
+
 const iocshArg createPSCUDPFastArg0 = {"name", iocshArgString};
 const iocshArg createPSCUDPFastArg1 = {"hostname", iocshArgString};
 const iocshArg createPSCUDPFastArg2 = {"hostport#", iocshArgInt};
@@ -738,9 +2225,58 @@ void createPSCUDPFastArgsCallFunc(const iocshArgBuf *args)
     createPSCUDPFast(args[0].sval, args[1].sval, args[2].ival, args[3].ival);
 }
 
+const iocshArg createPSCUDPFastReplayArg0 = {"name", iocshArgString};
+const iocshArg createPSCUDPFastReplayArg1 = {"file", iocshArgString};
+const iocshArg createPSCUDPFastReplayArg2 = {"speed", iocshArgDouble};
+const iocshArg * const createPSCUDPFastReplayArgs[] =
+{&createPSCUDPFastReplayArg0,&createPSCUDPFastReplayArg1,&createPSCUDPFastReplayArg2};
+const iocshFuncDef createPSCUDPFastReplayDef = {"createPSCUDPFastReplay", 3, createPSCUDPFastReplayArgs};
+void createPSCUDPFastReplayCallFunc(const iocshArgBuf *args)
+{
+    createPSCUDPFastReplay(args[0].sval, args[1].sval, args[2].dval);
+}
+
+const iocshArg addPSCUDPFastPeerArg0 = {"name", iocshArgString};
+const iocshArg addPSCUDPFastPeerArg1 = {"label", iocshArgString};
+const iocshArg addPSCUDPFastPeerArg2 = {"hostname", iocshArgString};
+const iocshArg addPSCUDPFastPeerArg3 = {"hostport#", iocshArgInt};
+const iocshArg addPSCUDPFastPeerArg4 = {"msgidbase", iocshArgInt};
+const iocshArg * const addPSCUDPFastPeerArgs[] =
+{&addPSCUDPFastPeerArg0,&addPSCUDPFastPeerArg1,&addPSCUDPFastPeerArg2,&addPSCUDPFastPeerArg3,&addPSCUDPFastPeerArg4};
+const iocshFuncDef addPSCUDPFastPeerDef = {"addPSCUDPFastPeer", 5, addPSCUDPFastPeerArgs};
+void addPSCUDPFastPeerCallFunc(const iocshArgBuf *args)
+{
+    addPSCUDPFastPeer(args[0].sval, args[1].sval, args[2].sval, args[3].ival, args[4].ival);
+}
+
+const iocshArg setPSCUDPFastShmArg0 = {"name", iocshArgString};
+const iocshArg setPSCUDPFastShmArg1 = {"shmname", iocshArgString};
+const iocshArg setPSCUDPFastShmArg2 = {"sizeMB", iocshArgDouble};
+const iocshArg * const setPSCUDPFastShmArgs[] =
+{&setPSCUDPFastShmArg0,&setPSCUDPFastShmArg1,&setPSCUDPFastShmArg2};
+const iocshFuncDef setPSCUDPFastShmDef = {"setPSCUDPFastShm", 3, setPSCUDPFastShmArgs};
+void setPSCUDPFastShmCallFunc(const iocshArgBuf *args)
+{
+    setPSCUDPFastShm(args[0].sval, args[1].sval, args[2].dval);
+}
+
+const iocshArg setPSCUDPRecordPolicyArg0 = {"name", iocshArgString};
+const iocshArg setPSCUDPRecordPolicyArg1 = {"policy", iocshArgString};
+const iocshArg * const setPSCUDPRecordPolicyArgs[] =
+{&setPSCUDPRecordPolicyArg0,&setPSCUDPRecordPolicyArg1};
+const iocshFuncDef setPSCUDPRecordPolicyDef = {"setPSCUDPRecordPolicy", 2, setPSCUDPRecordPolicyArgs};
+void setPSCUDPRecordPolicyCallFunc(const iocshArgBuf *args)
+{
+    setPSCUDPRecordPolicy(args[0].sval, args[1].sval);
+}
+
 void pscudp()
 {
     iocshRegister(&createPSCUDPFastDef, &createPSCUDPFastArgsCallFunc);
+    iocshRegister(&createPSCUDPFastReplayDef, &createPSCUDPFastReplayCallFunc);
+    iocshRegister(&addPSCUDPFastPeerDef, &addPSCUDPFastPeerCallFunc);
+    iocshRegister(&setPSCUDPFastShmDef, &setPSCUDPFastShmCallFunc);
+    iocshRegister(&setPSCUDPRecordPolicyDef, &setPSCUDPRecordPolicyCallFunc);
 
     auto lim = sysconf(_SC_IOV_MAX);
     if(lim>0)
@@ -765,6 +2301,20 @@ bool report1(int lvl, const PSCBase* base)
         pendingCnt = drv->pending.size();
     }
     printf("  vpool#=%zu pending#=%zu\n", vpoolCnt, pendingCnt);
+    if(drv->shm)
+        printf("  shm %s published#=%zu skipped#=%zu\n", drv->shm->name().c_str(),
+               drv->shm->npublished, drv->shm->nskipped);
+    if(!drv->mcastGroup.empty())
+        printf("  multicast %s iface=%s\n", drv->mcastGroup.c_str(),
+               drv->mcastIface.empty() ? "default" : drv->mcastIface.c_str());
+
+    for(size_t i=0; i<drv->peers.size(); i++) {
+        const UDPFast::Peer& peer = drv->peers[i];
+        char addr[64];
+        ipAddrToDottedIP(&peer.addr.ia, addr, sizeof(addr));
+        printf("  peer %s %s msgid+%u rx#=%zu bytes=%zu\n", peer.label.c_str(), addr, unsigned(peer.msgbase),
+               epicsAtomicGetSizeT(&peer.nrx), epicsAtomicGetSizeT(&peer.nbytes));
+    }
 
     return true;
 }
@@ -792,4 +2342,25 @@ epicsExportAddress(double, PSCUDPBufferPeriod);
 epicsExportAddress(double, PSCUDPMaxLenMB);
 epicsExportAddress(int, PSCUDPSetSockBuf);
 epicsExportAddress(int, PSCUDPDSyncSizeMB);
+epicsExportAddress(int, PSCUDPURingDepth);
+epicsExportAddress(int, PSCUDPDirectIOMB);
+epicsExportAddress(int, PSCUDPPreAlloc);
+epicsExportAddress(int, PSCUDPWritebackMB);
+epicsExportAddress(int, PSCUDPCompressLevel);
+epicsExportAddress(int, PSCUDPCompressThreads);
+epicsExportAddress(int, PSCUDPIndexPackets);
+epicsExportAddress(double, PSCUDPIndexPeriod);
+epicsExportAddress(int, PSCUDPStripeChunkMB);
+epicsExportAddress(int, PSCUDPSocketFilter);
+epicsExportAddress(int, PSCUDPBatchMin);
+epicsExportAddress(int, PSCUDPBatchMax);
+epicsExportAddress(int, PSCUDPZeroCopyCache);
+epicsExportAddress(int, PSCUDPPoolMaxMB);
+epicsExportAddress(int, PSCUDPPoolChunkMB);
+epicsExportAddress(double, PSCUDPPoolShrinkPeriod);
+epicsExportAddress(int, PSCUDPRxTimestamp);
+epicsExportAddress(int, PSCUDPBusyPollUS);
+epicsExportAddress(int, PSCUDPSpinUS);
+epicsExportAddress(int, PSCUDPTxRing);
+epicsExportAddress(int, PSCUDPGRO);
 }
@@ -8,28 +8,68 @@
 #ifndef UDPDRV_H
 #define UDPDRV_H
 
+#include <deque>
+
 #include <osiSock.h>
 #include <osiUnistd.h>
 
 #include <psc/device.h>
 
+class UDPDataFile;
+class UDPShmWriter;
+
 struct UDPFast : public PSCBase
 {
     SOCKET sock;
-    osiSockAddr self, peer;
+    osiSockAddr self;
+
+    // accepted sources.  [0] from createPSCUDPFast(), others from addPSCUDPFastPeer().
+    // Only changed before connect()
+    struct Peer {
+        std::string label;
+        osiSockAddr addr;
+        epicsUInt16 msgbase; // added to the msgid of packets from this peer
+        size_t nrx;          // packets received.  Changed only by rxfn(), read atomically
+        size_t nbytes;       // body bytes received.  Changed only by rxfn(), read atomically
+        Peer() :msgbase(0u), nrx(0u), nbytes(0u) {}
+    };
+    typedef std::vector<Peer> peers_t;
+    peers_t peers;
+    // when not empty, joined for each peer.  See joinMulticast()
+    std::string mcastGroup, mcastIface;
 
     int running;
-    size_t batchSize;
+    bool gro;           // UDP_GRO enabled.  See PSCUDPGRO
+    size_t batchSize;   // max. packets per recvmmsg()
+    size_t batchMin;    // min. packets per recvmmsg()
+    size_t batchActive; // current packets per recvmmsg().  Changed only by rxfn()
+    // # of recvmmsg() calls returning 1, 2-3, 4-7, ... , >=1024 packets
+    enum {batchHistSize = 11};
+    size_t batchHist[batchHistSize];
+    // # of packets from kernel RX timestamp until Block cache update of <2us, 2-4us, ... , >=32ms
+    enum {rxLatHistSize = 16};
+    size_t rxLatHist[rxLatHistSize];
+    // # of buffers originating with vpool.  Changed only by cachefn(), read atomically.
     size_t vpoolTotal;
+    // pool resizing.  See resizePool()
+    size_t vpoolMin;     // initial size.  Never shrinks below
+    size_t vpoolMax;     // growth limit.  ==vpoolMin to disable
+    size_t vpoolChunk;   // # of buffers added or removed at once
+    size_t vpoolBufSize; // bytes per buffer
+    size_t ngrow, nshrink;
+    epicsUInt64 poolQuiet; // monotonic ns when usage became low.  Only accessed by cachefn()
     size_t rxcnt;
     size_t ntimeout;
     size_t ndrops;
     size_t nignore;
     size_t noom;
+    size_t ngro; // receives of more than one coalesced datagram.  Changed only by rxfn()
     size_t lastsize;
 
     size_t netrx;
     size_t storewrote;
+    size_t compin, compout; // bytes into and out of compression
+    size_t ntx, ntxerr;     // packets sent, and not sent due to errors.  Changed only by txfn()
 
     typedef std::vector<std::vector<char> > vecs_t;
     // vector data free-list
@@ -37,7 +77,11 @@ struct UDPFast : public PSCBase
     //   vpool
     //   pending
     //   inprog - local to rxfn()
-    //   shortBuf
+    //   shortRings and shortFree
+    //   DataWriter - local to cachefn()
+    //   trigRing
+    //   seqCheck
+    //   Block::data - exchanged one for one.  See PSCUDPZeroCopyCache
     // guarded by rxLock
     vecs_t vpool;
 
@@ -45,10 +89,12 @@ struct UDPFast : public PSCBase
         std::vector<char> body;
         size_t bodylen;
         epicsTimeStamp rxtime;
+        epicsTimeStamp kerntime; // from SO_TIMESTAMPNS, or zero
         epicsUInt16 msgid;
 
         pkt() :bodylen(0u), msgid(0u) {
             rxtime.secPastEpoch = rxtime.nsec = 0u;
+            kerntime.secPastEpoch = kerntime.nsec = 0u;
         }
         void swap(pkt& o);
     };
@@ -66,9 +112,116 @@ struct UDPFast : public PSCBase
     bool reopen;
     bool record;
 
+    // triggered capture.  See documentation/udpfast.rst
+    bool trigMode;      // only write packets around triggers
+    double trigPre;     // seconds
+    double trigPost;    // seconds
+    bool trigPending;
+    epicsTimeStamp trigTime;
+    bool capturing;     // data file open for a trigger.  Changed only by cachefn()
+    epicsTimeStamp captureEnd;
+    size_t ntrig;
+    // pre-trigger packets, in order of reception.  Only accessed by cachefn()
+    std::deque<pkt> trigRing;
+
+    // per-msgid recording policy.  See documentation/udpfast.rst
+    struct RecordPolicy {
+        enum kind_t {All, None, Every, Rate} kind;
+        epicsUInt32 every;   // Every: record 1 of N
+        double period;       // Rate: min. seconds between recorded packets
+        epicsUInt32 count;   // packets seen
+        epicsTimeStamp last; // Rate: time of last recorded
+
+        RecordPolicy() :kind(All), every(1u), period(0.0), count(0u) {
+            last.secPastEpoch = last.nsec = 0u;
+        }
+
+        bool accept(const pkt& pkt) {
+            switch(kind) {
+            case All: return true;
+            case None: return false;
+            case Every: return count++%every==0u;
+            case Rate:
+                if(count++ && epicsTimeDiffInSeconds(&pkt.rxtime, &last) < period)
+                    return false;
+                last = pkt.rxtime;
+                return true;
+            }
+            return true;
+        }
+    };
+    typedef std::map<epicsUInt16, RecordPolicy> policy_map;
+    // msgids not present are recorded.  guarded by lock
+    policy_map recPolicy;
+    size_t nfiltered;
+
+    // Parse eg. "12=none 13=every:100 14=hz:10".
+    // If 'replace', then existing policies are discarded.
+    // throws std::runtime_error
+    void setRecordPolicy(const std::string& spec, bool replace);
+
+    // per-stage latency, accumulated by cachefn() and reset by readers.
+    struct Latency {
+        double sum, max; // sec
+        size_t count;
+        Latency() :sum(0.0), max(0.0), count(0u) {}
+        void add(double sec) {
+            sum += sec;
+            count++;
+            if(max < sec)
+                max = sec;
+        }
+    };
+    // guarded by lock
+    Latency latCache; // reception of oldest packet in batch until Block cache updated
+    Latency latWrite; // data file write of one batch
+    Latency latRx;    // kernel RX timestamp of each packet until Block cache updated
+
+    // per-msgid sequence checking.  See setPSCRecvSequence()
+    // guarded by lock
+    typedef SeqWindow<pkt, Block> seqwindow_t;
+    typedef std::map<epicsUInt16, seqwindow_t> seqcheck_t;
+    seqcheck_t seqCheck;
+    size_t seqHeld; // total packets held by all of seqCheck.  Bounded to vpoolMin/2
+
+    // per-msgid "short" buffers.  Each holds the first packets received after "Clear Short".
+    struct ShortRing {
+        pkts_t pkts;
+        size_t limit; // largest NELM of records reading this msgid
+        ShortRing() :limit(0u) {}
+    };
+    typedef std::map<epicsUInt16, ShortRing> shortrings_t;
     epicsMutex shortLock;
-    pkts_t shortBuf;
-    size_t shortLimit;
+    // guarded by shortLock.  Entries only added during record initialization
+    shortrings_t shortRings;
+    // [msgid] entry of shortRings, or NULL.  Empty until the first entry is added.
+    std::vector<ShortRing*> shortIndex;
+    size_t shortRoom; // total free space in shortRings
+    pkts_t shortFree; // cleared, to be returned to vpool by recycle()
+
+    // transmit.  Buffers cycle txFree -> txQueued -> txReady -> txFree
+    struct TXMsg {
+        std::vector<char> buf; // PSC header and body
+        size_t peer;           // destination index in peers
+        TXMsg() :peer(0u) {}
+    };
+    typedef std::vector<TXMsg> txmsgs_t;
+    // guarded by lock.  Queued, but not yet flushed
+    txmsgs_t txQueued;
+    epicsMutex txLock;
+    // guarded by txLock
+    txmsgs_t txFree;  // pre-allocated.  See PSCUDPTxRing
+    txmsgs_t txReady; // flushed, not yet sent
+    epicsEvent txWakeup;
+
+    // when set, packets are replayed from this recording instead of received.
+    // Owned.  See createPSCUDPFastReplay()
+    UDPDataFile *replaySrc;
+    double replaySpeed; // relative to original.  <=0 for as fast as possible
+
+    // when set, all received packets are also published to shared memory.
+    // Owned.  Only accessed by cachefn() after connect().  See setPSCUDPFastShm()
+    UDPShmWriter *shm;
 
     // rx worker pulls from socket buffer and pushes to 'pending'
     struct RXWorker : public epicsThreadRunable
@@ -91,6 +244,16 @@ struct UDPFast : public PSCBase
     } cachejob;
     epicsThread cacheworker;
 
+    // tx worker sends flushed messages
+    struct TXWorker : public epicsThreadRunable
+    {
+        UDPFast * const self;
+        explicit TXWorker(UDPFast* self) : self(self) {}
+        virtual ~TXWorker() {}
+        virtual void run() override final { self->txfn(); }
+    } txjob;
+    epicsThread txworker;
+
     UDPFast(const std::string& name,
             const std::string& host,
             unsigned short port,
@@ -98,19 +261,50 @@ struct UDPFast : public PSCBase
 
     virtual ~UDPFast();
 
+    // accept packets from another source.  Must be called before connect().
+    // throws std::runtime_error
+    void addPeer(const std::string& label, const std::string& host, unsigned short port, epicsUInt16 msgbase);
+
     void rxfn();;
+    // split one UDP_GRO receive of 'len' bytes, in segments of 'segsize', into 'pending'.
+    // Begins at offset 'off'.  Stops early when vpool is empty, leaving 'off' at the first segment not split.
+    // 'nseg' is incremented for each segment split.
+    // Called from rxfn() with rxLock held.  Returns network bytes accepted.
+    size_t splitGRO(const std::vector<char>& buf, size_t len, size_t segsize, size_t& off, size_t& nseg,
+                    Peer& peer, const epicsTimeStamp& rxtime, const epicsTimeStamp& kerntime);
+    // replacement for rxfn() when replaySrc is set
+    void replayfn();
 
     void cachefn();
 
+    void txfn();
+    // take a buffer from txFree and fill in the PSC header.  Caller must lock.
+    std::vector<char>& queueHeader(Block *blk, epicsUInt32 buflen);
+
+    // move consumed packets to shortRings, and return remaining buffers (and shortFree) to vpool
+    void recycle(pkts_t& pkts);
+    // grow or shrink vpool according to usage.  Called from cachefn() without locks.
+    void resizePool();
+
+    // triggered capture steps of cachefn()
+    void triggered(pkts_t& inprog, pkts_t& done, const epicsTimeStamp& now);
+    void trigExpire(pkts_t& done, const epicsTimeStamp& oldest, size_t limit);
+    // sequence checking step of cachefn().  Discarded packets are moved to 'done'.
+    void sequence(pkts_t& inprog, pkts_t& ordered, pkts_t& done, bool idle);
+
     virtual void connect() override final;
     virtual void stop() override final;
 
-    virtual void queueSend(epicsUInt16, const void *, epicsUInt32) override final {}
-    virtual void queueSend(Block *, const dbuffer &) override final {}
-    virtual void queueSend(Block *, const void *, epicsUInt32) override final {}
-    virtual void flushSend() override final {}
+    virtual void queueSend(epicsUInt16, const void *, epicsUInt32) override final;
+    virtual void queueSend(Block *, const dbuffer &) override final;
+    virtual void queueSend(Block *, const void *, epicsUInt32) override final;
+    virtual void flushSend() override final;
     virtual void forceReConnect() override final {}
 
+    virtual void setRecvSequence(epicsUInt16 block, epicsUInt32 offset, epicsUInt32 window) override final;
+
+    virtual void joinMulticast(const std::string& group, const std::string& iface) override final;
+
     virtual void report(int lvl) override final {}
 };
 
@@ -0,0 +1,265 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "udpreader.h"
+
+namespace {
+
+struct FD {
+    int fd;
+    explicit FD(int fd) :fd(fd) {}
+    ~FD() { if(fd>=0) close(fd); }
+};
+
+std::runtime_error sysError(const char *op, const std::string& fname)
+{
+    int err = errno;
+    std::ostringstream strm;
+    strm<<op<<"(\""<<fname<<"\") : ("<<err<<") "<<strerror(err);
+    return std::runtime_error(strm.str());
+}
+
+// map an entire file read-only.  Returns NULL for an empty file
+const char* mapFile(const std::string& fname, epicsUInt64& len, bool optional)
+{
+    len = 0u;
+    FD fd(open(fname.c_str(), O_RDONLY|O_CLOEXEC));
+    if(fd.fd<0) {
+        if(optional && errno==ENOENT)
+            return 0;
+        throw sysError("open", fname);
+    }
+
+    struct stat info;
+    if(fstat(fd.fd, &info))
+        throw sysError("fstat", fname);
+    if(info.st_size==0)
+        return 0;
+
+    void *mem = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd.fd, 0);
+    if(mem==MAP_FAILED)
+        throw sysError("mmap", fname);
+
+    // records are mostly read once, front to back
+    (void)madvise(mem, info.st_size, MADV_SEQUENTIAL);
+
+    len = info.st_size;
+    return static_cast<const char*>(mem);
+}
+
+// .idx entry.  See FileIndexEntry
+const size_t indexEntrySize = 20u;
+
+inline epicsUInt32 getU32(const char *buf)
+{
+    const epicsUInt8 *B = reinterpret_cast<const epicsUInt8*>(buf);
+    return (epicsUInt32(B[0])<<24u) | (epicsUInt32(B[1])<<16u) | (epicsUInt32(B[2])<<8u) | B[3];
+}
+
+inline epicsUInt64 indexTime(const char *ent)
+{
+    return epicsUInt64(getU32(ent+4))*1000000000u + getU32(ent+8);
+}
+
+inline epicsUInt64 indexOffset(const char *ent)
+{
+    return (epicsUInt64(getU32(ent+12))<<32u) | getU32(ent+16);
+}
+
+// heap ordering for UDPMergeReader.  std::*_heap() keep the greatest element first,
+// so this is "greater than" to find the earliest record.
+struct LaterRecord {
+    bool operator()(const UDPRecord& lhs, const UDPRecord& rhs) const {
+        epicsUInt64 L = lhs.time(), R = rhs.time();
+        if(L!=R)
+            return L>R;
+        if(lhs.chunk!=rhs.chunk)
+            return lhs.chunk>rhs.chunk;
+        if(lhs.file!=rhs.file)
+            return lhs.file>rhs.file;
+        return lhs.offset>rhs.offset;
+    }
+};
+
+} // namespace
+
+UDPDataFile::UDPDataFile(const std::string& fname)
+    :fname(fname)
+    ,base(0)
+    ,len(0u)
+    ,index(0)
+    ,indexLen(0u)
+    ,nindex(0u)
+{
+    base = mapFile(fname, len, false);
+
+    if(base && len>=16u && base[0]=='P' && base[1]=='Z') {
+        munmap(const_cast<char*>(base), len);
+        throw std::runtime_error(fname+" : compressed .datz files are not supported");
+    }
+    if(base && len>=16u && (base[0]!='P' || (base[1]!='S' && base[1]!='C'))) {
+        munmap(const_cast<char*>(base), len);
+        throw std::runtime_error(fname+" : not a .dat file");
+    }
+
+    try {
+        index = mapFile(fname+".idx", indexLen, true);
+        nindex = indexLen/indexEntrySize; // ignore any partial entry
+    } catch(std::runtime_error&) {
+        // the index is only an aid
+        index = 0;
+        indexLen = 0u;
+        nindex = 0u;
+    }
+}
+
+UDPDataFile::~UDPDataFile()
+{
+    if(base)
+        munmap(const_cast<char*>(base), len);
+    if(index)
+        munmap(const_cast<char*>(index), indexLen);
+}
+
+epicsUInt64 UDPDataFile::seek(epicsUInt64 time) const
+{
+    // find the first entry at or after 'time'.
+    // Callers allow for entries slightly out of order.  See UDPFilter::slack
+    size_t lo = 0u, hi = nindex;
+    while(lo<hi) {
+        size_t mid = lo + (hi-lo)/2u;
+        if(indexTime(index + mid*indexEntrySize) < time)
+            lo = mid+1u;
+        else
+            hi = mid;
+    }
+    // records between the previous entry and this one may also be at or after 'time'
+    if(lo==0u)
+        return 0u;
+    epicsUInt64 offset = indexOffset(index + (lo-1u)*indexEntrySize);
+    UDPRecord rec;
+    epicsUInt64 chunk;
+    if(striped()) {
+        // begin at a chunk header, to know the chunk number.  Each chunk header is indexed.
+        while(!chunkAt(offset, chunk)) {
+            if(--lo==0u)
+                return 0u;
+            offset = indexOffset(index + (lo-1u)*indexEntrySize);
+        }
+    } else if(!at(offset, rec)) {
+        return 0u; // index does not match data.  Scan everything.
+    }
+    return offset;
+}
+
+UDPFileReader::UDPFileReader(const UDPDataFile& file, const UDPFilter& filter, size_t fileidx)
+    :file(file)
+    ,filter(filter)
+    ,fileidx(fileidx)
+    ,offset(file.seek(filter.begin > filter.slack ? filter.begin - filter.slack : 0u))
+    ,chunk(0u)
+    ,latest(0u)
+    ,backward(0u)
+    ,ended(false)
+{}
+
+bool UDPFileReader::next(UDPRecord& rec)
+{
+    while(!ended) {
+        if(file.chunkAt(offset, chunk)) {
+            offset += 16u;
+            continue;
+        }
+        if(!file.at(offset, rec))
+            return false;
+        const epicsUInt64 T = rec.time();
+        if(T < latest)
+            backward = std::max(backward, latest - T);
+        else
+            latest = T;
+        if(T >= filter.end && T - filter.end >= filter.slack) {
+            // all later records are also outside the window.  'offset' stays at this record
+            ended = true;
+            break;
+        }
+        offset += 16u + rec.bodylen;
+        if(filter.match(rec)) {
+            rec.file = fileidx;
+            rec.chunk = chunk;
+            return true;
+        }
+    }
+    return false;
+}
+
+UDPMergeReader::UDPMergeReader(const UDPFilter& filter)
+    :filter(filter)
+    ,started(false)
+{}
+
+UDPMergeReader::~UDPMergeReader()
+{
+    for(size_t i=0; i<readers.size(); i++)
+        delete readers[i];
+    for(size_t i=0; i<files.size(); i++)
+        delete files[i];
+}
+
+void UDPMergeReader::add(const std::string& fname)
+{
+    if(started)
+        throw std::logic_error("UDPMergeReader::add() after next()");
+
+    files.reserve(files.size()+1u);
+    readers.reserve(readers.size()+1u);
+
+    UDPDataFile *file = new UDPDataFile(fname);
+    files.push_back(file);
+    readers.push_back(new UDPFileReader(*file, filter, files.size()-1u));
+}
+
+bool UDPMergeReader::next(UDPRecord& rec)
+{
+    LaterRecord later;
+
+    if(!started) {
+        started = true;
+        heap.reserve(readers.size());
+        for(size_t i=0; i<readers.size(); i++) {
+            UDPRecord first;
+            if(readers[i]->next(first))
+                heap.push_back(first);
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+    }
+
+    if(heap.empty())
+        return false;
+
+    std::pop_heap(heap.begin(), heap.end(), later);
+    rec = heap.back();
+
+    // replace with the next record from the same file
+    if(readers[rec.file]->next(heap.back()))
+        std::push_heap(heap.begin(), heap.end(), later);
+    else
+        heap.pop_back();
+
+    return true;
+}
@@ -0,0 +1,209 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef UDPREADER_H
+#define UDPREADER_H
+
+/* Offline reading of .dat files recorded by PSCUDPFast.
+ * See documentation/udpfast.rst
+ *
+ * Files are mmap()'d and records are decoded in place.
+ * No IOC runtime is needed.
+ */
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+
+// One record.  'body' points into the file mapping, and is valid
+// for the lifetime of the UDPDataFile
+struct UDPRecord {
+    epicsUInt16 msgid;
+    epicsUInt32 bodylen;
+    epicsUInt32 sec;     // since POSIX epoch
+    epicsUInt32 nsec;
+    const char *body;
+    epicsUInt64 offset;  // of record header in file
+    size_t file;         // index of source file when merging
+    epicsUInt64 chunk;   // chunk number in a striped recording.  Zero otherwise
+
+    UDPRecord() :msgid(0u), bodylen(0u), sec(0u), nsec(0u), body(0), offset(0u), file(0u), chunk(0u) {}
+
+    // ns since POSIX epoch
+    epicsUInt64 time() const { return epicsUInt64(sec)*1000000000u + nsec; }
+};
+
+// Record selection.  Default matches everything
+struct UDPFilter {
+    // when not empty, indexed by msgid
+    std::vector<bool> msgids;
+    // time window [begin, end) in ns since POSIX epoch
+    epicsUInt64 begin, end;
+    // records of a file may be out of time order by up to this many ns.
+    // eg. held for reordering, or after a small clock step.
+    // Reading begins this much before 'begin', and stops at a record this much after 'end'.
+    epicsUInt64 slack;
+
+    UDPFilter() :begin(0u), end(epicsUInt64(-1)), slack(1000000000u) {}
+
+    void allow(epicsUInt16 msgid) {
+        if(msgids.empty())
+            msgids.resize(0x10000, false);
+        msgids[msgid] = true;
+    }
+
+    bool match(const UDPRecord& rec) const {
+        if(!msgids.empty() && !msgids[rec.msgid])
+            return false;
+        epicsUInt64 T = rec.time();
+        return T>=begin && T<end;
+    }
+};
+
+// A read-only mapping of one .dat file, and its .idx sidecar if present.
+class UDPDataFile {
+public:
+    // throws std::runtime_error
+    explicit UDPDataFile(const std::string& fname);
+    ~UDPDataFile();
+
+    const std::string& name() const { return fname; }
+    epicsUInt64 size() const { return len; }
+    bool indexed() const { return nindex!=0u; }
+    // one file of a striped recording
+    bool striped() const { return len>=16u && base[1]=='C'; }
+
+    // Decode the record at 'offset'.
+    // Returns false at end of file, or if there is not a valid record at 'offset'.
+    // eg. the zero filled tail of a preallocated file, or a chunk header.
+    inline bool at(epicsUInt64 offset, UDPRecord& rec) const;
+    // Decode the chunk header at 'offset'.
+    // Returns false if there is not a chunk header at 'offset'.
+    inline bool chunkAt(epicsUInt64 offset, epicsUInt64& chunk) const;
+
+    // File offset from which to begin scanning for records at or after 'time'.
+    // Uses the .idx sidecar if present, otherwise zero.
+    epicsUInt64 seek(epicsUInt64 time) const;
+
+private:
+    const std::string fname;
+    const char *base;
+    epicsUInt64 len;
+    const char *index;
+    epicsUInt64 indexLen; // mapped
+    size_t nindex;
+
+    UDPDataFile(const UDPDataFile&);
+    UDPDataFile& operator=(const UDPDataFile&);
+};
+
+// Iterate the records of one file which match a filter
+class UDPFileReader {
+public:
+    UDPFileReader(const UDPDataFile& file, const UDPFilter& filter, size_t fileidx=0u);
+
+    // Returns false when no more records match.
+    // Records in a file are mostly in time order, so reading stops at the first record
+    // at or after filter.end + filter.slack
+    bool next(UDPRecord& rec);
+
+    // offset after the last valid record.  Only meaningful after next() returns false.
+    // If less than file size, and not pastEnd(), then the tail is not valid records.
+    epicsUInt64 position() const { return offset; }
+    // stopped at filter.end before the end of valid records
+    bool pastEnd() const { return ended; }
+    // largest step back in time (ns) between records read so far.
+    // If more than filter.slack, some records in the time window may have been missed.
+    epicsUInt64 disorder() const { return backward; }
+
+private:
+    const UDPDataFile& file;
+    const UDPFilter& filter;
+    const size_t fileidx;
+    epicsUInt64 offset;
+    epicsUInt64 chunk; // current
+    epicsUInt64 latest; // time of latest record read
+    epicsUInt64 backward;
+    bool ended;
+};
+
+// k-way merge of records from several files (eg. a sequence of rotated files) by reception time.
+// Records with equal times are ordered by chunk (to reassemble a striped recording), then file, then offset.
+// Records out of time order within one file are merged in file order.
+class UDPMergeReader {
+public:
+    explicit UDPMergeReader(const UDPFilter& filter);
+    ~UDPMergeReader();
+
+    // Must be called before the first next().  throws std::runtime_error
+    void add(const std::string& fname);
+
+    size_t nfiles() const { return files.size(); }
+    const UDPDataFile& file(size_t i) const { return *files[i]; }
+    // See UDPFileReader::position()
+    epicsUInt64 position(size_t i) const { return readers[i]->position(); }
+    // See UDPFileReader::pastEnd()
+    bool pastEnd(size_t i) const { return readers[i]->pastEnd(); }
+    // See UDPFileReader::disorder()
+    epicsUInt64 disorder(size_t i) const { return readers[i]->disorder(); }
+
+    bool next(UDPRecord& rec);
+
+private:
+    const UDPFilter filter;
+    std::vector<UDPDataFile*> files;
+    std::vector<UDPFileReader*> readers;
+    // min-heap of the next record from each reader
+    std::vector<UDPRecord> heap;
+    bool started;
+
+    UDPMergeReader(const UDPMergeReader&);
+    UDPMergeReader& operator=(const UDPMergeReader&);
+};
+
+bool UDPDataFile::at(epicsUInt64 offset, UDPRecord& rec) const
+{
+    // 16 byte header.  See FileRecordHeader
+    if(offset > len || len - offset < 16u)
+        return false;
+
+    const epicsUInt8 *H = reinterpret_cast<const epicsUInt8*>(base + offset);
+    if(H[0]!='P' || H[1]!='S')
+        return false;
+
+    epicsUInt32 bodylen = (epicsUInt32(H[4])<<24u) | (epicsUInt32(H[5])<<16u) | (epicsUInt32(H[6])<<8u) | H[7];
+    if(len - offset - 16u < bodylen)
+        return false; // truncated
+
+    rec.msgid = (epicsUInt16(H[2])<<8u) | H[3];
+    rec.bodylen = bodylen;
+    rec.sec  = (epicsUInt32(H[8])<<24u) | (epicsUInt32(H[9])<<16u) | (epicsUInt32(H[10])<<8u) | H[11];
+    rec.nsec = (epicsUInt32(H[12])<<24u) | (epicsUInt32(H[13])<<16u) | (epicsUInt32(H[14])<<8u) | H[15];
+    rec.body = base + offset + 16u;
+    rec.offset = offset;
+    return true;
+}
+
+bool UDPDataFile::chunkAt(epicsUInt64 offset, epicsUInt64& chunk) const
+{
+    // 16 byte header.  See FileChunkHeader
+    if(offset > len || len - offset < 16u)
+        return false;
+
+    const epicsUInt8 *H = reinterpret_cast<const epicsUInt8*>(base + offset);
+    if(H[0]!='P' || H[1]!='C')
+        return false;
+
+    chunk = 0u;
+    for(unsigned i=8u; i<16u; i++)
+        chunk = (chunk<<8u) | H[i];
+    return true;
+}
+
+#endif // UDPREADER_H
@@ -0,0 +1,253 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include "udpshm.h"
+
+#if !defined(__GNUC__)
+#  error Needs GCC compatible __atomic builtins
+#endif
+
+namespace {
+
+struct FD {
+    int fd;
+    explicit FD(int fd) :fd(fd) {}
+    ~FD() { if(fd>=0) close(fd); }
+};
+
+std::runtime_error sysError(const char *op, const std::string& name)
+{
+    int err = errno;
+    std::ostringstream strm;
+    strm<<op<<"(\""<<name<<"\") : ("<<err<<") "<<strerror(err);
+    return std::runtime_error(strm.str());
+}
+
+const char shmMagic[8] = {'P', 'S', 'C', 'S', 'H', 'M', 0, 0};
+const epicsUInt32 shmVersion = 1u;
+
+// 16 byte record header, and 8 byte alignment.  See FileRecordHeader
+const epicsUInt64 recHeaderSize = 16u;
+
+inline epicsUInt64 padded(epicsUInt64 len)
+{
+    return (len + 7u) & ~epicsUInt64(7u);
+}
+
+inline epicsUInt32 getU32(const char *buf)
+{
+    const epicsUInt8 *B = reinterpret_cast<const epicsUInt8*>(buf);
+    return (epicsUInt32(B[0])<<24u) | (epicsUInt32(B[1])<<16u) | (epicsUInt32(B[2])<<8u) | B[3];
+}
+
+} // namespace
+
+UDPShmWriter::UDPShmWriter(const std::string& name, size_t size)
+    :npublished(0u)
+    ,nskipped(0u)
+    ,shmname(name)
+    ,H(0)
+    ,ring(0)
+    ,maplen(0u)
+    ,mask(0u)
+    ,pos(0u)
+{
+    epicsUInt64 ringsize = 4096u;
+    while(ringsize < size)
+        ringsize <<= 1u;
+    mask = ringsize-1u;
+    maplen = sizeof(UDPShmHeader) + ringsize;
+
+    // replace any leftover from a previous run.  Readers of the old segment see no more records.
+    (void)shm_unlink(name.c_str());
+
+    FD fd(shm_open(name.c_str(), O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0644));
+    if(fd.fd<0)
+        throw sysError("shm_open", name);
+
+    if(ftruncate(fd.fd, maplen)) {
+        std::runtime_error err(sysError("ftruncate", name));
+        (void)shm_unlink(name.c_str());
+        throw err;
+    }
+
+    void *mem = mmap(0, maplen, PROT_READ|PROT_WRITE, MAP_SHARED, fd.fd, 0);
+    if(mem==MAP_FAILED) {
+        std::runtime_error err(sysError("mmap", name));
+        (void)shm_unlink(name.c_str());
+        throw err;
+    }
+
+    H = static_cast<UDPShmHeader*>(mem);
+    ring = static_cast<char*>(mem) + sizeof(UDPShmHeader);
+
+    // new pages are zero filled.  magic last so that readers see a complete header.
+    H->size = ringsize;
+    H->writerpid = getpid();
+    H->version = shmVersion;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(H->magic, shmMagic, sizeof(shmMagic));
+}
+
+UDPShmWriter::~UDPShmWriter()
+{
+    (void)munmap(H, maplen);
+    (void)shm_unlink(shmname.c_str());
+}
+
+bool UDPShmWriter::publish(const void *hdr, const char *body, epicsUInt32 bodylen)
+{
+    const epicsUInt64 need = padded(recHeaderSize + bodylen);
+    if(need > mask+1u) {
+        nskipped++;
+        return false;
+    }
+
+    epicsUInt64 off = pos & mask;
+    if(off + need > mask+1u) {
+        // skip to start of ring.  (mask+1u - off) is at least 8
+        __atomic_store_n(&H->reserve, pos + (mask+1u - off) + need, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        ring[off] = 'P';
+        ring[off+1u] = 'W';
+        pos += mask+1u - off;
+        off = 0u;
+    } else {
+        __atomic_store_n(&H->reserve, pos + need, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    memcpy(ring + off, hdr, recHeaderSize);
+    memcpy(ring + off + recHeaderSize, body, bodylen);
+    pos += need;
+    npublished++;
+    return true;
+}
+
+void UDPShmWriter::commit()
+{
+    __atomic_store_n(&H->head, pos, __ATOMIC_RELEASE);
+}
+
+UDPShmReader::UDPShmReader(const std::string& name)
+    :H(0)
+    ,ring(0)
+    ,maplen(0u)
+    ,size(0u)
+    ,mask(0u)
+    ,pos(0u)
+    ,cur(0u)
+    ,noverrun(0u)
+    ,nlost(0u)
+{
+    FD fd(shm_open(name.c_str(), O_RDONLY|O_CLOEXEC, 0));
+    if(fd.fd<0)
+        throw sysError("shm_open", name);
+
+    struct stat info;
+    if(fstat(fd.fd, &info))
+        throw sysError("fstat", name);
+    if(size_t(info.st_size) < sizeof(UDPShmHeader))
+        throw std::runtime_error("Not a PSCUDPFast shared memory segment: "+name);
+
+    void *mem = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd.fd, 0);
+    if(mem==MAP_FAILED)
+        throw sysError("mmap", name);
+    maplen = info.st_size;
+    H = static_cast<UDPShmHeader*>(mem);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(memcmp(H->magic, shmMagic, sizeof(shmMagic))!=0 || H->version!=shmVersion
+            || H->size==0u || (H->size & (H->size-1u)) || sizeof(UDPShmHeader)+H->size > maplen) {
+        (void)munmap(mem, maplen);
+        throw std::runtime_error("Not a PSCUDPFast shared memory segment, or incompatible version: "+name);
+    }
+
+    ring = static_cast<const char*>(mem) + sizeof(UDPShmHeader);
+    size = H->size;
+    mask = size-1u;
+    pos = cur = __atomic_load_n(&H->head, __ATOMIC_ACQUIRE);
+}
+
+UDPShmReader::~UDPShmReader()
+{
+    (void)munmap(H, maplen);
+}
+
+void UDPShmReader::overrun()
+{
+    const epicsUInt64 head = __atomic_load_n(&H->head, __ATOMIC_ACQUIRE);
+    noverrun++;
+    nlost += head - cur;
+    pos = cur = head;
+}
+
+bool UDPShmReader::valid()
+{
+    // order preceding reads of the ring before reading 'reserve'
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    const epicsUInt64 reserve = __atomic_load_n(&H->reserve, __ATOMIC_RELAXED);
+    if(reserve <= size || reserve - size <= cur)
+        return true;
+    overrun();
+    return false;
+}
+
+bool UDPShmReader::next(UDPRecord& rec)
+{
+    while(true) {
+        const epicsUInt64 head = __atomic_load_n(&H->head, __ATOMIC_ACQUIRE);
+        cur = pos;
+        if(head - pos > size) {
+            overrun(); // lapped
+            continue;
+        } else if(pos==head) {
+            return false;
+        }
+
+        const epicsUInt64 off = pos & mask;
+        const char *R = ring + off;
+        if(R[0]=='P' && R[1]=='W') {
+            if(!valid())
+                continue;
+            pos += size - off;
+            continue;
+        }
+
+        const epicsUInt32 bodylen = getU32(R+4);
+        const bool ok = R[0]=='P' && R[1]=='S' && off + recHeaderSize + bodylen <= size;
+
+        rec.msgid = (epicsUInt16(epicsUInt8(R[2]))<<8u) | epicsUInt8(R[3]);
+        rec.bodylen = bodylen;
+        rec.sec = getU32(R+8);
+        rec.nsec = getU32(R+12);
+        rec.body = R + recHeaderSize;
+        rec.offset = pos;
+        rec.file = 0u;
+        rec.chunk = 0u;
+
+        // a header overwritten while being decoded may be garbage
+        if(!valid())
+            continue;
+        if(!ok)
+            throw std::runtime_error("Corrupt record in shared memory ring");
+
+        pos += padded(recHeaderSize + bodylen);
+        return true;
+    }
+}
@@ -0,0 +1,112 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef UDPSHM_H
+#define UDPSHM_H
+
+/* Live fan-out of packets received by PSCUDPFast through POSIX shared memory.
+ * See documentation/udpfast.rst
+ *
+ * One writer (the IOC) and any number of readers in other processes.
+ * Readers never block, or signal, the writer.  A reader which falls
+ * more than one ring behind detects the overrun and skips ahead.
+ *
+ * A 64 byte UDPShmHeader is followed by a ring of 'size' bytes (a power of 2).
+ * Records in the ring have the same layout as .dat files (16 byte header and body),
+ * each padded to a multiple of 8 bytes.  A record never wraps around the end of the ring.
+ * Instead, a 'P','W' marker skips the remainder.
+ *
+ * Positions are byte counts since the segment was created.
+ * The writer advances 'reserve' before overwriting, and 'head' once records are complete.
+ * The ring bytes for positions [pos, head) are intact while 'reserve' - size <= pos.
+ */
+
+#include <string>
+
+#include <epicsTypes.h>
+
+#include "udpreader.h"
+
+struct UDPShmHeader {
+    char magic[8];         // "PSCSHM" followed by two zero bytes
+    epicsUInt64 size;      // of ring in bytes
+    epicsUInt64 head;      // end of last complete record.  Only increases
+    epicsUInt64 reserve;   // end of bytes being written.  Only increases
+    epicsUInt32 writerpid;
+    epicsUInt32 version;   // currently 1
+    char reserved[24];
+};
+
+class UDPShmWriter {
+public:
+    // Create, or replace, shared memory segment 'name' (eg. "/fast") with a ring of at least 'size' bytes.
+    // throws std::runtime_error
+    UDPShmWriter(const std::string& name, size_t size);
+    // also unlinks
+    ~UDPShmWriter();
+
+    const std::string& name() const { return shmname; }
+
+    // Append one record.  'hdr' is a 16 byte FileRecordHeader.
+    // Not visible to readers until commit().  Returns false if the record can never fit.
+    bool publish(const void *hdr, const char *body, epicsUInt32 bodylen);
+    // make all published records visible
+    void commit();
+
+    size_t npublished, nskipped;
+
+private:
+    const std::string shmname;
+    UDPShmHeader *H;
+    char *ring;
+    size_t maplen;
+    epicsUInt64 mask;
+    epicsUInt64 pos; // next write.  >= H->head
+
+    UDPShmWriter(const UDPShmWriter&);
+    UDPShmWriter& operator=(const UDPShmWriter&);
+};
+
+class UDPShmReader {
+public:
+    // Open existing shared memory segment 'name' read-only.  Reading begins with the next record published.
+    // throws std::runtime_error
+    explicit UDPShmReader(const std::string& name);
+    ~UDPShmReader();
+
+    // Decode the next record in place.  Returns false if none is available yet.
+    // 'rec.body' points into the ring, and may be overwritten by the writer at any time.
+    // 'rec.offset' is the stream position.
+    bool next(UDPRecord& rec);
+    // After using the record from the last next(), check that it was not overwritten while in use.
+    // If not valid, then the record must be discarded, and the overrun is counted.
+    bool valid();
+
+    // # of times this reader fell behind and skipped ahead
+    size_t overruns() const { return noverrun; }
+    // total bytes skipped by overruns
+    epicsUInt64 lost() const { return nlost; }
+    // PID of the IOC which created the segment
+    epicsUInt32 writer() const { return H->writerpid; }
+
+private:
+    UDPShmHeader *H;
+    const char *ring;
+    size_t maplen;
+    epicsUInt64 size, mask;
+    epicsUInt64 pos;  // next record
+    epicsUInt64 cur;  // start of last record returned by next()
+    size_t noverrun;
+    epicsUInt64 nlost;
+
+    void overrun();
+
+    UDPShmReader(const UDPShmReader&);
+    UDPShmReader& operator=(const UDPShmReader&);
+};
+
+#endif // UDPSHM_H
@@ -0,0 +1,1528 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <algorithm>
+#include <sstream>
+
+#include <errlog.h>
+
+#ifdef USE_URING
+#  include <liburing.h>
+#endif
+#ifdef USE_ZSTD
+#  include <zstd.h>
+#endif
+
+#include <epicsAtomic.h>
+#include <psc/thread.h>
+
+#include "udpwriter.h"
+
+namespace {
+
+// satisfies the O_DIRECT alignment requirements of all common devices/filesystems
+const size_t directAlign = 4096u;
+
+struct WritevWriter : public DataWriter
+{
+    std::vector<iovec> ios;
+    std::vector<FileRecordHeader> headers;
+
+    WritevWriter(const std::string& name, size_t iovLimit)
+        :DataWriter(name)
+        ,ios(iovLimit)
+        ,headers(ios.size()/2u) // round down to multiple of 2
+    {}
+    virtual ~WritevWriter() {}
+
+    virtual int submit(pkts_t& inprog) override final
+    {
+        // iterate inprog and write in batches
+        for(size_t i=0, N=inprog.size(); i<N;) {
+            size_t batchtotal = 0u;
+            size_t b, B;
+
+            for(b=0, B=headers.size(); i<N && b<B; i++, b++) {
+                auto& pkt = inprog[i];
+                auto& H = headers[b];
+                auto& IOhead = ios[2*b+0];
+                auto& IObody = ios[2*b+1];
+
+                H.fill(pkt);
+                if(index)
+                    index->note(pkt, offset + batchtotal);
+
+                IOhead.iov_base = &H;
+                IOhead.iov_len = sizeof(H);
+                IObody.iov_base = &pkt.body[0];
+                IObody.iov_len = pkt.bodylen;
+                batchtotal += sizeof(H) + pkt.bodylen;
+            }
+
+            ssize_t ret = writev(fd, &ios[0], 2*b);
+            if(ret<0) {
+                int err = errno;
+                if(PSCDebug>=0)
+                    errlogPrintf("%s : data file write error: (%d) %s\n", name.c_str(), err, strerror(err));
+                return err;
+
+            } else if(size_t(ret)!=batchtotal) {
+                if(PSCDebug>=0)
+                    errlogPrintf("%s : data file write incomplete %zd of %zu\n", name.c_str(), ret, batchtotal);
+                return EIO;
+            }
+
+            offset += batchtotal;
+        }
+        return 0;
+    }
+
+    virtual int mark(const FileChunkHeader& chunk, const UDPFast::pkt& first) override final
+    {
+        if(index)
+            index->add(first, offset);
+
+        ssize_t ret = write(fd, &chunk, sizeof(chunk));
+        if(ret<0) {
+            int err = errno;
+            if(PSCDebug>=0)
+                errlogPrintf("%s : data file write error: (%d) %s\n", name.c_str(), err, strerror(err));
+            return err;
+
+        } else if(size_t(ret)!=sizeof(chunk)) {
+            if(PSCDebug>=0)
+                errlogPrintf("%s : data file write incomplete %zd of %zu\n", name.c_str(), ret, sizeof(chunk));
+            return EIO;
+        }
+        offset += sizeof(chunk);
+        return 0;
+    }
+
+    virtual int sync() override final
+    {
+        if(fdatasync(fd))
+            return errno;
+        return 0;
+    }
+
+    // we never take buffers
+    virtual int reap(pkts_t& done, bool wait) override final { return 0; }
+    virtual bool busy() const override final { return false; }
+};
+
+/* Copy packets into a large aligned staging buffer, which is written with O_DIRECT
+ * at aligned offsets to bypass the page cache.  The final partial block is zero padded,
+ * then the file is truncated to its true length.
+ */
+struct DirectWriter : public DataWriter
+{
+    char *stage;
+    const size_t stagesize;
+    size_t fill;            // bytes in stage
+    epicsUInt64 diskoffset; // aligned file position of stage[0]
+
+    DirectWriter(const std::string& name, size_t bufsize)
+        :DataWriter(name)
+        ,stage(0)
+        ,stagesize(std::max(directAlign, bufsize - bufsize%directAlign))
+        ,fill(0u)
+        ,diskoffset(0u)
+    {
+        void *mem = 0;
+        if(posix_memalign(&mem, directAlign, stagesize))
+            throw std::bad_alloc();
+        stage = static_cast<char*>(mem);
+    }
+    virtual ~DirectWriter()
+    {
+        free(stage);
+    }
+
+    virtual int openFlags() const override final { return O_DIRECT; }
+
+    virtual void open(int fd) override final
+    {
+        DataWriter::open(fd);
+        fill = 0u;
+        diskoffset = 0u;
+    }
+
+    // write out first 'len' bytes of stage.  'len' must be aligned.
+    int flushStage(size_t len)
+    {
+        ssize_t ret = pwrite(fd, stage, len, diskoffset);
+        if(ret<0) {
+            int err = errno;
+            if(PSCDebug>=0)
+                errlogPrintf("%s : data file write error: (%d) %s\n", name.c_str(), err, strerror(err));
+            return err;
+
+        } else if(size_t(ret)!=len) {
+            if(PSCDebug>=0)
+                errlogPrintf("%s : data file write incomplete %zd of %zu\n", name.c_str(), ret, len);
+            return EIO;
+        }
+        diskoffset += len;
+        return 0;
+    }
+
+    int put(const void *buf, size_t len)
+    {
+        const char *cbuf = static_cast<const char*>(buf);
+        while(len) {
+            size_t n = std::min(len, stagesize - fill);
+            memcpy(stage + fill, cbuf, n);
+            fill += n;
+            cbuf += n;
+            len -= n;
+            offset += n;
+
+            if(fill==stagesize) {
+                if(int err = flushStage(stagesize))
+                    return err;
+                fill = 0u;
+            }
+        }
+        return 0;
+    }
+
+    virtual int submit(pkts_t& inprog) override final
+    {
+        FileRecordHeader H;
+        for(size_t i=0, N=inprog.size(); i<N; i++) {
+            const UDPFast::pkt& pkt = inprog[i];
+
+            H.fill(pkt);
+            if(index)
+                index->note(pkt, offset);
+            if(int err = put(&H, sizeof(H)))
+                return err;
+            if(int err = put(&pkt.body[0], pkt.bodylen))
+                return err;
+        }
+        return 0;
+    }
+
+    virtual int mark(const FileChunkHeader& chunk, const UDPFast::pkt& first) override final
+    {
+        if(index)
+            index->add(first, offset);
+        return put(&chunk, sizeof(chunk));
+    }
+
+    virtual int finish() override final
+    {
+        if(fill) {
+            size_t padded = fill + (directAlign - fill%directAlign)%directAlign;
+            memset(stage + fill, 0, padded - fill);
+            if(int err = flushStage(padded))
+                return err;
+            fill = 0u;
+        }
+        // discard padding
+        if(ftruncate(fd, offset))
+            return errno;
+        return 0;
+    }
+
+    virtual int sync() override final
+    {
+        // only metadata (eg. size) should be dirty
+        if(fdatasync(fd))
+            return errno;
+        return 0;
+    }
+
+    // we never take buffers
+    virtual int reap(pkts_t& done, bool wait) override final { return 0; }
+    virtual bool busy() const override final { return false; }
+    // excludes the staged tail, and padding
+    virtual epicsUInt64 completed() const override final { return std::min(diskoffset, offset); }
+};
+
+#ifdef USE_URING
+
+/* Each io_uring write request is a writev() of up to iovLimit/2 packets
+ * at an explicit file offset.  Packet buffers are held by the request
+ * until its completion is reap()'d.
+ */
+struct URingWriter : public DataWriter
+{
+    io_uring ring;
+
+    struct Req {
+        pkts_t pkts;
+        std::vector<FileRecordHeader> headers;
+        std::vector<iovec> ios;
+        size_t expect;
+        epicsUInt64 at; // file offset
+    };
+    std::vector<Req> reqs;
+    std::vector<size_t> idle; // indices into reqs
+    size_t nbusy;
+    bool syncBusy;
+    int err; // first error seen by a completion
+    pkts_t stash; // completed while submit()ing
+
+    // user_data of sync requests.  Others are an index into reqs
+    static const __u64 syncTag = __u64(-1);
+
+    URingWriter(const std::string& name, unsigned depth, size_t iovLimit)
+        :DataWriter(name)
+        ,reqs(depth)
+        ,nbusy(0u)
+        ,syncBusy(false)
+        ,err(0)
+    {
+        // room for every write and one sync
+        int ret = io_uring_queue_init(depth+1u, &ring, 0);
+        if(ret<0)
+            throw std::runtime_error(std::string("io_uring_queue_init() : ")+strerror(-ret));
+
+        idle.reserve(depth);
+        for(size_t i=0; i<reqs.size(); i++) {
+            Req& req = reqs[i];
+            req.headers.resize(iovLimit/2u);
+            req.ios.resize(2u*req.headers.size());
+            req.pkts.reserve(req.headers.size());
+            req.expect = 0u;
+            req.at = 0u;
+            idle.push_back(reqs.size()-1u-i);
+        }
+    }
+    virtual ~URingWriter()
+    {
+        // caller should have reap()'d.  Make sure the kernel is done with our buffers.
+        pkts_t junk;
+        (void)reap(junk, true);
+        io_uring_queue_exit(&ring);
+    }
+
+    virtual void open(int fd) override final
+    {
+        assert(!busy());
+        DataWriter::open(fd);
+        err = 0;
+    }
+
+    // process at most one completion.
+    // Returns 1 if processed, 0 if none available, or -errno
+    int complete1(pkts_t& done, bool wait)
+    {
+        io_uring_cqe *cqe = 0;
+        int ret = wait ? io_uring_wait_cqe(&ring, &cqe) : io_uring_peek_cqe(&ring, &cqe);
+        if(ret==-EAGAIN || ret==-EINTR) {
+            return 0;
+        } else if(ret<0) {
+            return ret;
+        }
+
+        __u64 tag = cqe->user_data;
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+
+        if(tag==syncTag) {
+            syncBusy = false;
+            if(res<0 && !err) {
+                err = -res;
+                errlogPrintf("%s : fdatasync error %s (%d)\n", name.c_str(), strerror(err), err);
+            }
+
+        } else {
+            Req& req = reqs.at(tag);
+
+            if(res<0) {
+                if(!err)
+                    err = -res;
+                if(PSCDebug>=0)
+                    errlogPrintf("%s : data file write error: (%d) %s\n", name.c_str(), -res, strerror(-res));
+
+            } else if(size_t(res)!=req.expect) {
+                if(!err)
+                    err = EIO;
+                if(PSCDebug>=0)
+                    errlogPrintf("%s : data file write incomplete %d of %zu\n", name.c_str(), res, req.expect);
+            }
+
+            for(size_t i=0, N=req.pkts.size(); i<N; i++) {
+                done.push_back(UDPFast::pkt());
+                done.back().swap(req.pkts[i]);
+            }
+            req.pkts.clear();
+
+            idle.push_back(tag);
+            nbusy--;
+        }
+        return 1;
+    }
+
+    virtual int submit(pkts_t& inprog) override final
+    {
+        if(err)
+            return err;
+
+        for(size_t i=0, N=inprog.size(); i<N;) {
+
+            if(idle.empty()) {
+                // all requests in flight.  Hand queued SQEs to the kernel, then wait for one to complete.
+                // completed buffers are stashed until the next reap()
+                int ret = io_uring_submit(&ring);
+                if(ret<0)
+                    return -ret;
+                while(idle.empty()) {
+                    if((ret = complete1(stash, true)) < 0)
+                        return -ret;
+                }
+                if(err)
+                    return err;
+            }
+
+            io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+            if(!sqe) {
+                // SQ sized to prevent this
+                return ENOBUFS;
+            }
+
+            size_t idx = idle.back();
+            idle.pop_back();
+            Req& req = reqs[idx];
+
+            size_t b, B;
+            req.expect = 0u;
+            for(b=0, B=req.headers.size(); i<N && b<B; i++, b++) {
+                auto& H = req.headers[b];
+                auto& IOhead = req.ios[2*b+0];
+                auto& IObody = req.ios[2*b+1];
+
+                // take ownership of buffer
+                req.pkts.push_back(UDPFast::pkt());
+                UDPFast::pkt& pkt = req.pkts.back();
+                pkt.swap(inprog[i]);
+
+                H.fill(pkt);
+                if(index)
+                    index->note(pkt, offset + req.expect);
+
+                IOhead.iov_base = &H;
+                IOhead.iov_len = sizeof(H);
+                IObody.iov_base = &pkt.body[0];
+                IObody.iov_len = pkt.bodylen;
+                req.expect += sizeof(H) + pkt.bodylen;
+            }
+
+            io_uring_prep_writev(sqe, fd, &req.ios[0], 2*b, offset);
+            sqe->user_data = idx;
+            req.at = offset;
+            offset += req.expect;
+            nbusy++;
+        }
+
+        int ret = io_uring_submit(&ring);
+        if(ret<0)
+            return -ret;
+        return 0;
+    }
+
+    virtual int mark(const FileChunkHeader& chunk, const UDPFast::pkt& first) override final
+    {
+        if(err)
+            return err;
+        if(index)
+            index->add(first, offset);
+
+        // small, and rare.  Written directly at its place after any writes in flight.
+        ssize_t ret = pwrite(fd, &chunk, sizeof(chunk), offset);
+        if(ret<0) {
+            err = errno;
+            if(PSCDebug>=0)
+                errlogPrintf("%s : data file write error: (%d) %s\n", name.c_str(), err, strerror(err));
+            return err;
+
+        } else if(size_t(ret)!=sizeof(chunk)) {
+            if(PSCDebug>=0)
+                errlogPrintf("%s : data file write incomplete %zd of %zu\n", name.c_str(), ret, sizeof(chunk));
+            return err = EIO;
+        }
+        offset += sizeof(chunk);
+        return 0;
+    }
+
+    virtual int sync() override final
+    {
+        if(err)
+            return err;
+        if(syncBusy)
+            return 0; // previous sync still in flight, skip this one
+
+        io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        if(!sqe)
+            return ENOBUFS;
+
+        io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+        // start only after all previously submitted writes have completed
+        io_uring_sqe_set_flags(sqe, IOSQE_IO_DRAIN);
+        sqe->user_data = syncTag;
+        syncBusy = true;
+
+        int ret = io_uring_submit(&ring);
+        if(ret<0)
+            return -ret;
+        return 0;
+    }
+
+    virtual int reap(pkts_t& done, bool wait) override final
+    {
+        for(size_t i=0, N=stash.size(); i<N; i++) {
+            done.push_back(UDPFast::pkt());
+            done.back().swap(stash[i]);
+        }
+        stash.clear();
+
+        while(busy()) {
+            int ret = complete1(done, wait);
+            if(ret<0)
+                return -ret;
+            else if(ret==0 && !wait)
+                break;
+        }
+        return err;
+    }
+
+    virtual bool busy() const override final { return nbusy || syncBusy; }
+
+    // writes complete in any order.  So up to the earliest still in flight.
+    virtual epicsUInt64 completed() const override final
+    {
+        epicsUInt64 ret = offset;
+        for(size_t i=0; nbusy && i<reqs.size(); i++) {
+            if(!reqs[i].pkts.empty())
+                ret = std::min(ret, reqs[i].at);
+        }
+        return ret;
+    }
+};
+
+#endif // USE_URING
+
+#ifdef USE_ZSTD
+
+/* Packets are grouped into frames of about compressFrameSize bytes,
+ * which are compressed by a pool of worker threads.
+ * Compressed frames are written, in order, by reap().
+ * Each frame begins with a FileFrameHeader, followed by one zstd frame
+ * which decompresses to the usual .dat records.
+ */
+struct CompressWriter : public DataWriter
+{
+    // target uncompressed frame size
+    static size_t frameSize() { return 1u<<20u; }
+    // a partial frame older than this is dispatched by submit()
+    static double frameAge() { return 1.0; }
+
+    struct Frame {
+        pkts_t pkts;
+        size_t rawlen;
+        std::vector<char> out; // [FileChunkHeader] + FileFrameHeader + compressed
+        int err;
+        bool ready; // compressed
+        bool marked; // begins a chunk
+        FileChunkHeader chunk;
+        Frame() :rawlen(0u), err(0), ready(false), marked(false), chunk(0u, 0u, 0u) {}
+    };
+
+    struct Worker : public epicsThreadRunable {
+        CompressWriter *self;
+        ZSTD_CCtx *ctx;
+        epicsThread thread;
+        Worker(CompressWriter *self, int level)
+            :self(self)
+            ,ctx(ZSTD_createCCtx())
+            ,thread(*this, "udpfz", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityMedium)
+        {
+            if(!ctx)
+                throw std::bad_alloc();
+            ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, level);
+            ZSTD_CCtx_setParameter(ctx, ZSTD_c_checksumFlag, 1);
+        }
+        virtual ~Worker() {
+            ZSTD_freeCCtx(ctx);
+        }
+        virtual void run() override final {
+            pscThreadApply("udpfz", self->name.c_str());
+            self->workfn(*this);
+        }
+    };
+
+    size_t * const compressIn;
+    size_t * const compressOut;
+
+    mutable epicsMutex lock;
+    epicsEvent workReady, frameReady;
+    // guarded by lock
+    bool running;
+    std::deque<Frame*> inorder; // dispatched frames, in file order
+    std::deque<Frame*> todo;    // dispatched frames awaiting a worker
+    std::vector<Frame*> spare;
+    // accumulating.  Only accessed by caller
+    Frame *cur;
+    bool syncPending;
+
+    std::vector<Worker*> workers;
+
+    CompressWriter(const std::string& name, const Config& conf)
+        :DataWriter(name)
+        ,compressIn(conf.compressIn)
+        ,compressOut(conf.compressOut)
+        ,running(true)
+        ,cur(new Frame)
+        ,syncPending(false)
+    {
+        for(unsigned i=0; i<std::max(1u, conf.compressThreads); i++) {
+            workers.push_back(new Worker(this, conf.compressLevel));
+            workers.back()->thread.start();
+        }
+    }
+    virtual ~CompressWriter()
+    {
+        {
+            Guard G(lock);
+            running = false;
+        }
+        for(size_t i=0; i<workers.size(); i++)
+            workReady.signal();
+        for(size_t i=0; i<workers.size(); i++) {
+            workers[i]->thread.exitWait();
+            delete workers[i];
+        }
+        // caller should have reap()'d
+        for(size_t i=0; i<inorder.size(); i++)
+            delete inorder[i];
+        for(size_t i=0; i<spare.size(); i++)
+            delete spare[i];
+        delete cur;
+    }
+
+    virtual const char* extension() const override final { return ".datz"; }
+
+    void workfn(Worker& W)
+    {
+        Guard G(lock);
+        while(true) {
+            if(todo.empty()) {
+                if(!running)
+                    break;
+                UnGuard U(G);
+                workReady.wait();
+                continue;
+            }
+
+            Frame *frame = todo.front();
+            todo.pop_front();
+            if(!todo.empty())
+                workReady.signal(); // pass it on
+
+            {
+                UnGuard U(G);
+                compress(W.ctx, *frame);
+            }
+
+            frame->ready = true;
+            frameReady.signal();
+        }
+    }
+
+    // Consume all of 'in', and with ZSTD_e_end, flush the frame.
+    // Returns false on error, or if the compressor makes no progress (eg. output full).
+    bool feed(ZSTD_CCtx *ctx, ZSTD_outBuffer& out, ZSTD_inBuffer& in, ZSTD_EndDirective mode)
+    {
+        while(true) {
+            const size_t inpos = in.pos, outpos = out.pos;
+            size_t ret = ZSTD_compressStream2(ctx, &out, &in, mode);
+            if(ZSTD_isError(ret)) {
+                errlogPrintf("%s : compress error : %s\n", name.c_str(), ZSTD_getErrorName(ret));
+                return false;
+            } else if(mode==ZSTD_e_end ? ret==0u : in.pos==in.size) {
+                return true;
+            } else if(in.pos==inpos && out.pos==outpos) {
+                errlogPrintf("%s : compress stalled with %zu of %zu input bytes\n",
+                             name.c_str(), in.pos, in.size);
+                return false;
+            }
+        }
+    }
+
+    void compress(ZSTD_CCtx *ctx, Frame& frame)
+    {
+        // a chunk header is placed before the frame header
+        const size_t clen = frame.marked ? sizeof(FileChunkHeader) : 0u;
+        const size_t hlen = clen + sizeof(FileFrameHeader);
+        frame.out.resize(hlen + ZSTD_compressBound(frame.rawlen));
+
+        ZSTD_CCtx_reset(ctx, ZSTD_reset_session_only);
+        ZSTD_CCtx_setPledgedSrcSize(ctx, frame.rawlen);
+
+        ZSTD_outBuffer out = {&frame.out[hlen], frame.out.size()-hlen, 0u};
+        FileRecordHeader H;
+
+        for(size_t i=0, N=frame.pkts.size(); i<N && !frame.err; i++) {
+            const UDPFast::pkt& pkt = frame.pkts[i];
+            H.fill(pkt);
+
+            ZSTD_inBuffer inhead = {&H, sizeof(H), 0u};
+            ZSTD_inBuffer inbody = {&pkt.body[0], pkt.bodylen, 0u};
+
+            if(!feed(ctx, out, inhead, ZSTD_e_continue) || !feed(ctx, out, inbody, ZSTD_e_continue))
+                frame.err = EIO;
+        }
+
+        if(!frame.err) {
+            ZSTD_inBuffer empty = {0, 0u, 0u};
+            if(!feed(ctx, out, empty, ZSTD_e_end))
+                frame.err = EIO;
+        }
+
+        frame.out.resize(hlen + out.pos);
+
+        FileFrameHeader F;
+        F.complen = htonl(out.pos);
+        F.rawlen = htonl(frame.rawlen);
+        F.npkts = htonl(frame.pkts.size());
+        if(!frame.pkts.empty()) {
+            F.sec = htonl(frame.pkts[0].rxtime.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH);
+            F.nsec = htonl(frame.pkts[0].rxtime.nsec);
+        } else {
+            F.sec = F.nsec = 0u;
+        }
+        if(clen)
+            memcpy(&frame.out[0], &frame.chunk, clen);
+        memcpy(&frame.out[clen], &F, sizeof(F));
+    }
+
+    void dispatch()
+    {
+        if(cur->pkts.empty())
+            return;
+        Frame *next = 0;
+        {
+            Guard G(lock);
+            inorder.push_back(cur);
+            todo.push_back(cur);
+            if(!spare.empty()) {
+                next = spare.back();
+                spare.pop_back();
+            }
+        }
+        workReady.signal();
+        cur = next ? next : new Frame;
+    }
+
+    virtual int submit(pkts_t& inprog) override final
+    {
+        for(size_t i=0, N=inprog.size(); i<N; i++) {
+            UDPFast::pkt& pkt = inprog[i];
+
+            if(!cur->pkts.empty() && epicsTimeDiffInSeconds(&pkt.rxtime, &cur->pkts[0].rxtime) > frameAge())
+                dispatch();
+
+            // take ownership of buffer
+            cur->rawlen += sizeof(FileRecordHeader) + pkt.bodylen;
+            cur->pkts.push_back(UDPFast::pkt());
+            cur->pkts.back().swap(pkt);
+
+            if(cur->rawlen >= frameSize())
+                dispatch();
+        }
+        return 0;
+    }
+
+    // a chunk begins with a new frame.  Indexed by reap() along with the frame
+    virtual int mark(const FileChunkHeader& chunk, const UDPFast::pkt& first) override final
+    {
+        dispatch();
+        cur->marked = true;
+        cur->chunk = chunk;
+        return 0;
+    }
+
+    // deferred until all dispatched frames are written
+    virtual int sync() override final
+    {
+        syncPending = true;
+        return 0;
+    }
+
+    virtual int reap(pkts_t& done, bool wait) override final
+    {
+        if(wait) {
+            dispatch(); // flush partial frame
+
+        } else if(!cur->pkts.empty()) {
+            // source may have gone quiet
+            epicsTimeStamp now;
+            epicsTimeGetCurrent(&now);
+            if(epicsTimeDiffInSeconds(&now, &cur->pkts[0].rxtime) > frameAge())
+                dispatch();
+        }
+
+        int err = 0;
+        Guard G(lock);
+        while(!inorder.empty()) {
+            Frame *frame = inorder.front();
+            if(!frame->ready) {
+                if(!wait)
+                    break;
+                UnGuard U(G);
+                frameReady.wait();
+                continue;
+            }
+            inorder.pop_front();
+
+            {
+                UnGuard U(G);
+
+                if(!err && frame->err)
+                    err = frame->err;
+
+                if(!err) {
+                    ssize_t ret = write(fd, &frame->out[0], frame->out.size());
+                    if(ret<0) {
+                        err = errno;
+                        if(PSCDebug>=0)
+                            errlogPrintf("%s : data file write error: (%d) %s\n", name.c_str(), err, strerror(err));
+                    } else if(size_t(ret)!=frame->out.size()) {
+                        err = EIO;
+                        if(PSCDebug>=0)
+                            errlogPrintf("%s : data file write incomplete %zd of %zu\n", name.c_str(), ret, frame->out.size());
+                    } else {
+                        // frames can only be decompressed from the start, so each is indexed
+                        if(index && !frame->pkts.empty())
+                            index->add(frame->pkts[0], offset);
+                        offset += ret;
+                        if(compressIn)
+                            epicsAtomicAddSizeT(compressIn, frame->rawlen);
+                        if(compressOut)
+                            epicsAtomicAddSizeT(compressOut, frame->out.size());
+                    }
+                }
+
+                for(size_t i=0, N=frame->pkts.size(); i<N; i++) {
+                    done.push_back(UDPFast::pkt());
+                    done.back().swap(frame->pkts[i]);
+                }
+                frame->pkts.clear();
+                frame->rawlen = 0u;
+                frame->err = 0;
+                frame->ready = false;
+                frame->marked = false;
+            }
+
+            spare.push_back(frame);
+        }
+
+        if(syncPending && inorder.empty()) {
+            UnGuard U(G);
+            syncPending = false;
+            if(!err && fdatasync(fd))
+                err = errno;
+        }
+        return err;
+    }
+
+    virtual bool busy() const override final
+    {
+        Guard G(lock);
+        return !inorder.empty() || !cur->pkts.empty() || syncPending;
+    }
+};
+
+#endif // USE_ZSTD
+
+} // namespace
+
+DataWriter::DataWriter(const std::string& name)
+    :name(name)
+    ,fd(-1)
+    ,offset(0u)
+    ,index(0)
+{}
+
+DataWriter::~DataWriter() {}
+
+void DataWriter::open(int fd)
+{
+    this->fd = fd;
+    offset = 0u;
+}
+
+DataWriter* DataWriter::create(const std::string& name, const Config& conf)
+{
+#ifdef USE_ZSTD
+    if(conf.compressLevel>0) {
+        if(conf.directBuf || conf.uringDepth)
+            errlogPrintf("%s : compression selected, ignoring O_DIRECT and io_uring\n", name.c_str());
+        if(PSCDebug>=1)
+            errlogPrintf("%s : using zstd level %d with %u threads\n", name.c_str(),
+                         conf.compressLevel, conf.compressThreads);
+        return new CompressWriter(name, conf);
+    }
+#else
+    if(conf.compressLevel>0)
+        errlogPrintf("%s : built without zstd support, not compressing\n", name.c_str());
+#endif
+    if(conf.directBuf) {
+        if(conf.uringDepth)
+            errlogPrintf("%s : O_DIRECT selected, ignoring io_uring\n", name.c_str());
+        if(PSCDebug>=1)
+            errlogPrintf("%s : using O_DIRECT with %zu byte staging\n", name.c_str(), conf.directBuf);
+        return new DirectWriter(name, conf.directBuf);
+    }
+#ifdef USE_URING
+    if(conf.uringDepth) {
+        try {
+            DataWriter *ret = new URingWriter(name, conf.uringDepth, conf.iovLimit);
+            if(PSCDebug>=1)
+                errlogPrintf("%s : using io_uring depth=%u\n", name.c_str(), conf.uringDepth);
+            return ret;
+        } catch(std::exception& e) {
+            errlogPrintf("%s : unable to use io_uring, fall back to writev() : %s\n", name.c_str(), e.what());
+        }
+    }
+#else
+    if(conf.uringDepth)
+        errlogPrintf("%s : built without io_uring support, using writev()\n", name.c_str());
+#endif
+    return new WritevWriter(name, conf.iovLimit);
+}
+
+FileIndex::FileIndex(const std::string& name)
+    :everyPkts(0u)
+    ,everySec(0.0)
+    ,name(name)
+    ,npkts(0u)
+    ,written(false)
+{
+    last.secPastEpoch = last.nsec = 0u;
+}
+
+FileIndex::~FileIndex()
+{
+    close();
+}
+
+int FileIndex::open(const std::string& fname)
+{
+    close();
+    this->fname = fname;
+    npkts = 0u;
+    written = false;
+
+    fd.fd = ::open(fname.c_str(), O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+    if(!fd.isOpen()) {
+        int err = errno;
+        errlogPrintf("%s : Error opening index \"%s\" : (%d) %s\n", name.c_str(), fname.c_str(), err, strerror(err));
+        return err;
+    }
+    return 0;
+}
+
+void FileIndex::close()
+{
+    if(fd.isOpen()) {
+        (void)flush();
+        fd.close();
+    }
+    entries.clear();
+}
+
+void FileIndex::add(const UDPFast::pkt& pkt, epicsUInt64 offset)
+{
+    if(!fd.isOpen())
+        return;
+
+    entries.push_back(FileIndexEntry());
+    FileIndexEntry& E = entries.back();
+    E.msgid = htons(pkt.msgid);
+    E.sec = htonl(pkt.rxtime.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH);
+    E.nsec = htonl(pkt.rxtime.nsec);
+    E.offsethi = htonl(epicsUInt32(offset>>32u));
+    E.offsetlo = htonl(epicsUInt32(offset));
+
+    npkts = 0u;
+    last = pkt.rxtime;
+    written = true;
+}
+
+int FileIndex::flush()
+{
+    if(entries.empty() || !fd.isOpen())
+        return 0;
+
+    const size_t len = entries.size()*sizeof(entries[0]);
+    ssize_t ret = write(fd.fd, &entries[0], len);
+    entries.clear();
+
+    int err = 0;
+    if(ret<0)
+        err = errno;
+    else if(size_t(ret)!=len)
+        err = EIO;
+
+    if(err) {
+        // the index is an optional aid.  Give up on it, but continue recording data
+        errlogPrintf("%s : Error writing index \"%s\" : (%d) %s\n", name.c_str(), fname.c_str(), err, strerror(err));
+        fd.close();
+    }
+    return err;
+}
+
+int WritebackPacer::update(int fd, epicsUInt64 offset)
+{
+    if(!chunk)
+        return 0;
+
+    while(offset - started >= chunk) {
+        // start writeback of the newly completed chunk
+        if(sync_file_range(fd, started, chunk, SYNC_FILE_RANGE_WRITE))
+            return errno;
+        started += chunk;
+
+        if(started - dropped > chunk) {
+            // wait for the previous chunk, which should be (nearly) done by now
+            if(sync_file_range(fd, dropped, chunk,
+                               SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER))
+                return errno;
+            // clean pages may now be dropped
+            if(int err = posix_fadvise(fd, dropped, chunk, POSIX_FADV_DONTNEED))
+                return err;
+            dropped += chunk;
+        }
+    }
+    return 0;
+}
+
+int WritebackPacer::finish(int fd, epicsUInt64 offset)
+{
+    if(!chunk || offset<=started)
+        return 0;
+    if(sync_file_range(fd, started, offset-started, SYNC_FILE_RANGE_WRITE))
+        return errno;
+    started = offset;
+    return 0;
+}
+
+StripeWriter::StripeWriter(const std::string& name, unsigned stripe, unsigned nstripes, const Config& conf)
+    :stripe(stripe)
+    ,nstripes(nstripes)
+    ,name(name)
+    ,conf(conf)
+    ,writer(DataWriter::create(name, conf.writer))
+    ,index(name)
+    ,accounted(0u)
+    ,unsynced(0u)
+    ,fileerr(0)
+    ,error(0)
+    ,running(true)
+    ,active(false)
+    ,worker(*this, "udpfs", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityHigh-1)
+{
+    index.everyPkts = conf.indexPkts;
+    index.everySec = conf.indexSec;
+    if(index.enabled())
+        writer->index = &index;
+    pacer.chunk = conf.paceChunk;
+    worker.start();
+}
+
+StripeWriter::~StripeWriter()
+{
+    {
+        Guard G(lock);
+        running = false;
+    }
+    wakeup.signal();
+    worker.exitWait();
+    // caller should have close()'d, drain()'d, and reap()'d
+    for(size_t i=0; i<cmds.size(); i++)
+        delete cmds[i];
+    for(size_t i=0; i<spare.size(); i++)
+        delete spare[i];
+    delete writer;
+}
+
+StripeWriter::Cmd* StripeWriter::alloc(Cmd::kind_t kind)
+{
+    Cmd *cmd = 0;
+    {
+        Guard G(lock);
+        if(!spare.empty()) {
+            cmd = spare.back();
+            spare.pop_back();
+        }
+    }
+    if(!cmd)
+        cmd = new Cmd;
+    cmd->kind = kind;
+    cmd->start = false;
+    cmd->seq = 0u;
+    return cmd;
+}
+
+void StripeWriter::push(Cmd *cmd)
+{
+    {
+        Guard G(lock);
+        cmds.push_back(cmd);
+    }
+    wakeup.signal();
+}
+
+void StripeWriter::open(const std::string& fname)
+{
+    Cmd *cmd = alloc(Cmd::Open);
+    cmd->fname = fname;
+    push(cmd);
+}
+
+void StripeWriter::queue(pkts_t& pkts, size_t begin, size_t end, bool start, epicsUInt64 seq)
+{
+    Cmd *cmd = alloc(Cmd::Data);
+    cmd->start = start;
+    cmd->seq = seq;
+    for(size_t i=begin; i<end; i++) {
+        cmd->pkts.push_back(UDPFast::pkt());
+        cmd->pkts.back().swap(pkts[i]);
+    }
+    push(cmd);
+}
+
+void StripeWriter::close()
+{
+    push(alloc(Cmd::Close));
+}
+
+void StripeWriter::drain()
+{
+    Guard G(lock);
+    while(!cmds.empty() || active) {
+        UnGuard U(G);
+        drained.wait();
+    }
+}
+
+int StripeWriter::reap(pkts_t& done)
+{
+    Guard G(lock);
+    for(size_t i=0, N=reaped.size(); i<N; i++) {
+        done.push_back(UDPFast::pkt());
+        done.back().swap(reaped[i]);
+    }
+    reaped.clear();
+    int ret = error;
+    error = 0;
+    return ret;
+}
+
+bool StripeWriter::busy() const
+{
+    Guard G(lock);
+    return !cmds.empty() || active || !reaped.empty();
+}
+
+void StripeWriter::account()
+{
+    const epicsUInt64 wrote = writer->offset - accounted;
+    accounted = writer->offset;
+    unsynced += wrote;
+    if(conf.wrote)
+        epicsAtomicAddSizeT(conf.wrote, wrote);
+}
+
+void StripeWriter::fail(int err)
+{
+    if(!fileerr)
+        fileerr = err;
+    Guard G(lock);
+    if(!error)
+        error = err;
+}
+
+// complete and close the current file
+void StripeWriter::finish(pkts_t& done)
+{
+    if(!datafile.isOpen())
+        return;
+
+    int err = writer->reap(done, true);
+    if(!err)
+        err = writer->finish();
+    if(!err)
+        err = pacer.finish(datafile.fd, writer->offset);
+    account();
+    index.close();
+    datafile.close();
+    if(err)
+        fail(err);
+    if(PSCDebug>=1)
+        errlogPrintf("%s : closed \"%s\"\n", name.c_str(), fname.c_str());
+}
+
+void StripeWriter::execute(Cmd& cmd, pkts_t& done)
+{
+    switch(cmd.kind) {
+    case Cmd::Open: {
+        finish(done);
+        fname = cmd.fname;
+        fileerr = 0;
+
+        const int oflags = O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC;
+        datafile.fd = ::open(fname.c_str(), oflags|writer->openFlags(), 0644);
+        if(!datafile.isOpen() && errno==EINVAL && writer->openFlags()) {
+            errlogPrintf("%s : \"%s\" rejects special open flags.  Retry without\n", name.c_str(), fname.c_str());
+            datafile.fd = ::open(fname.c_str(), oflags, 0644);
+        }
+        if(!datafile.isOpen()) {
+            int err = errno;
+            errlogPrintf("%s : Error opening \"%s\" : (%d) %s\n", name.c_str(), fname.c_str(), err, strerror(err));
+            fail(err);
+            break;
+        }
+        if(PSCDebug>=1)
+            errlogPrintf("%s : opened \"%s\"\n", name.c_str(), fname.c_str());
+        writer->open(datafile.fd);
+        accounted = unsynced = 0u;
+        pacer.open();
+        if(index.enabled())
+            (void)index.open(fname+".idx");
+    }
+        break;
+
+    case Cmd::Data: {
+        if(!datafile.isOpen() || fileerr || cmd.pkts.empty())
+            break; // discard
+
+        int err = 0;
+        if(cmd.start)
+            err = writer->mark(FileChunkHeader(stripe, nstripes, cmd.seq), cmd.pkts[0]);
+        if(!err)
+            err = writer->submit(cmd.pkts);
+        if(!err)
+            err = writer->reap(done, false);
+
+        if(err) {
+            (void)writer->reap(done, true);
+            index.close();
+            datafile.close();
+            fail(err);
+            break;
+        }
+        (void)index.flush();
+        account();
+
+        if(conf.syncSize && unsynced >= conf.syncSize) {
+            unsynced = 0u;
+            if((err = writer->sync())!=0)
+                errlogPrintf("%s : fdatasync error %s (%d)\n", name.c_str(), strerror(err), err);
+        }
+        // only ranges already written.  eg. not still in flight with io_uring
+        if(!err && pacer.chunk && (err = pacer.update(datafile.fd, writer->completed()))!=0)
+            errlogPrintf("%s : writeback error %s (%d)\n", name.c_str(), strerror(err), err);
+        if(err)
+            fail(err);
+    }
+        break;
+
+    case Cmd::Close:
+        finish(done);
+        break;
+    }
+
+    // buffers not taken by the writer
+    for(size_t i=0, N=cmd.pkts.size(); i<N; i++) {
+        done.push_back(UDPFast::pkt());
+        done.back().swap(cmd.pkts[i]);
+    }
+    cmd.pkts.clear();
+}
+
+void StripeWriter::run()
+{
+    pscThreadApply("udpfs", name.c_str());
+
+    pkts_t done;
+
+    Guard G(lock);
+    while(true) {
+        for(size_t i=0, N=done.size(); i<N; i++) {
+            reaped.push_back(UDPFast::pkt());
+            reaped.back().swap(done[i]);
+        }
+        done.clear();
+
+        if(cmds.empty()) {
+            drained.signal();
+            if(!running)
+                break;
+            UnGuard U(G);
+            if(writer->busy()) {
+                // poll for completions while writes are in flight
+                (void)wakeup.wait(0.01);
+                int err = writer->reap(done, false);
+                if(err)
+                    fail(err);
+                account();
+            } else {
+                wakeup.wait();
+            }
+            continue;
+        }
+
+        Cmd *cmd = cmds.front();
+        cmds.pop_front();
+        active = true;
+        {
+            UnGuard U(G);
+            execute(*cmd, done);
+        }
+        active = false;
+        spare.push_back(cmd);
+    }
+
+    // caller should have close()'d
+    UnGuard U(G);
+    finish(done);
+}
+
+FileRotator::FileRotator(const std::string& name)
+    :name(name)
+    ,running(true)
+    ,sparefd(-1)
+    ,spareflags(0)
+    ,seq(0u)
+    ,worker(*this, "udpfio", epicsThreadGetStackSize(epicsThreadStackSmall), epicsThreadPriorityMedium)
+{
+    worker.start();
+}
+
+FileRotator::~FileRotator()
+{
+    {
+        Guard G(lock);
+        running = false;
+    }
+    wakeup.signal();
+    worker.exitWait();
+    // run() has completed all queued jobs
+    discardSpare();
+}
+
+void FileRotator::queue(const Job& job)
+{
+    {
+        Guard G(lock);
+        jobs.push_back(job);
+    }
+    wakeup.signal();
+}
+
+void FileRotator::prepare(const std::string& prefix, int flags, epicsUInt64 size)
+{
+    Job job;
+    job.kind = Job::Prepare;
+    job.a = prefix;
+    job.fd = -1;
+    job.flags = flags;
+    job.size = size;
+    queue(job);
+}
+
+int FileRotator::take(const std::string& prefix, int flags, std::string& tmpname)
+{
+    Guard G(lock);
+    if(sparefd<0 || spareprefix!=prefix || spareflags!=flags)
+        return -1;
+    int ret = sparefd;
+    tmpname = sparename;
+    sparefd = -1;
+    sparename.clear();
+    return ret;
+}
+
+void FileRotator::rename(const std::string& from, const std::string& to)
+{
+    Job job;
+    job.kind = Job::Rename;
+    job.a = from;
+    job.b = to;
+    job.fd = -1;
+    job.flags = 0;
+    job.size = 0u;
+    queue(job);
+}
+
+void FileRotator::retire(int fd, epicsUInt64 size)
+{
+    Job job;
+    job.kind = Job::Retire;
+    job.fd = fd;
+    job.flags = 0;
+    job.size = size;
+    queue(job);
+}
+
+std::string FileRotator::lastError()
+{
+    Guard G(lock);
+    std::string ret;
+    ret.swap(error);
+    return ret;
+}
+
+bool FileRotator::failedRename(std::string& from, std::string& to)
+{
+    Guard G(lock);
+    if(failedFrom.empty())
+        return false;
+    from.swap(failedFrom);
+    to.swap(failedTo);
+    failedFrom.clear();
+    failedTo.clear();
+    return true;
+}
+
+void FileRotator::setError(const std::string& msg)
+{
+    errlogPrintf("%s : %s\n", name.c_str(), msg.c_str());
+    Guard G(lock);
+    error = msg;
+}
+
+void FileRotator::discardSpare()
+{
+    int fd;
+    std::string fname;
+    {
+        Guard G(lock);
+        fd = sparefd;
+        fname.swap(sparename);
+        sparefd = -1;
+    }
+    if(fd>=0) {
+        ::close(fd);
+        ::unlink(fname.c_str());
+        if(PSCDebug>=2)
+            errlogPrintf("%s : discard spare \"%s\"\n", name.c_str(), fname.c_str());
+    }
+}
+
+void FileRotator::run()
+{
+    pscThreadApply("udpfio", name.c_str());
+
+    Guard G(lock);
+    while(true) {
+        if(jobs.empty()) {
+            if(!running)
+                break;
+            UnGuard U(G);
+            wakeup.wait();
+            continue;
+        }
+
+        Job job(jobs.front());
+        jobs.pop_front();
+
+        UnGuard U(G);
+
+        switch(job.kind) {
+        case Job::Prepare: {
+            {
+                Guard G2(lock);
+                if(sparefd>=0 && spareprefix==job.a && spareflags==job.flags)
+                    break; // already have a suitable spare
+            }
+            // filedir or filebase changed
+            discardSpare();
+
+            std::string fname;
+            {
+                std::ostringstream strm;
+                strm<<job.a<<"spare-"<<getpid()<<"-"<<seq++<<".tmp";
+                fname = strm.str();
+            }
+
+            const int oflags = O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC;
+            int fd = ::open(fname.c_str(), oflags|job.flags, 0644);
+            if(fd<0 && errno==EINVAL && job.flags)
+                fd = ::open(fname.c_str(), oflags, 0644);
+            if(fd<0) {
+                int err = errno;
+                std::ostringstream strm;
+                strm<<"Error creating spare \""<<fname<<"\" : ("<<err<<") "<<strerror(err);
+                setError(strm.str());
+                break;
+            }
+
+            if(job.size && fallocate(fd, 0, 0, job.size)) {
+                int err = errno;
+                // not fatal.  File will be extended on demand.
+                if(PSCDebug>=1 || (err!=EOPNOTSUPP && err!=ENOSYS))
+                    errlogPrintf("%s : unable to preallocate \"%s\" : (%d) %s\n",
+                                 name.c_str(), fname.c_str(), err, strerror(err));
+            }
+
+            if(PSCDebug>=2)
+                errlogPrintf("%s : ready spare \"%s\"\n", name.c_str(), fname.c_str());
+
+            Guard G2(lock);
+            sparefd = fd;
+            sparename = fname;
+            spareprefix = job.a;
+            spareflags = job.flags;
+        }
+            break;
+
+        case Job::Rename:
+            // emulate O_EXCL of ::open()
+            if(::link(job.a.c_str(), job.b.c_str())==0) {
+                ::unlink(job.a.c_str());
+
+            } else if(errno!=EEXIST && ::access(job.b.c_str(), F_OK)!=0
+                      && ::rename(job.a.c_str(), job.b.c_str())==0) {
+                // filesystem w/o hard links
+
+            } else {
+                int err = errno;
+                std::ostringstream strm;
+                strm<<"Error renaming \""<<job.a<<"\" -> \""<<job.b<<"\" : ("<<err<<") "<<strerror(err)
+                    <<".  Data remains in \""<<job.a<<"\"";
+                setError(strm.str());
+                Guard G2(lock);
+                failedFrom = job.a;
+                failedTo = job.b;
+            }
+            break;
+
+        case Job::Retire:
+            // discard any preallocated tail
+            if(ftruncate(job.fd, job.size)) {
+                int err = errno;
+                errlogPrintf("%s : unable to truncate data file : (%d) %s\n", name.c_str(), err, strerror(err));
+            }
+            ::close(job.fd);
+            break;
+        }
+    }
+}
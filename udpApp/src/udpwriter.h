@@ -0,0 +1,404 @@
+/*************************************************************************\
+* Copyright (c) 2021 Brookhaven Science Assoc. as operator of
+      Brookhaven National Laboratory.
+* EPICS BASE is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef UDPWRITER_H
+#define UDPWRITER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <sys/uio.h>
+
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <errlog.h>
+
+#include "udpdrv.h"
+
+// .dat file record header.  See documentation/udpfast.rst
+struct FileRecordHeader {
+    char P, S;
+    epicsUInt16 msgid;
+    epicsUInt32 bodylen;
+    epicsUInt32 sec;
+    epicsUInt32 nsec;
+    FileRecordHeader() :P('P'), S('S') {}
+
+    void fill(const UDPFast::pkt& pkt) {
+        msgid = htons(pkt.msgid);
+        bodylen = htonl(pkt.bodylen);
+        sec = htonl(pkt.rxtime.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH);
+        nsec = htonl(pkt.rxtime.nsec);
+    }
+};
+
+// .datz compressed frame header.  See documentation/udpfast.rst
+struct FileFrameHeader {
+    char P, Z;
+    epicsUInt16 reserved;
+    epicsUInt32 complen;   // compressed bytes following this header
+    epicsUInt32 rawlen;    // decompressed length
+    epicsUInt32 npkts;     // number of records in frame
+    epicsUInt32 sec;       // time of first record
+    epicsUInt32 nsec;
+    FileFrameHeader() :P('P'), Z('Z'), reserved(0u) {}
+};
+
+// .dat chunk header.  Begins each chunk of a striped recording.  See documentation/udpfast.rst
+struct FileChunkHeader {
+    char P, C;
+    epicsUInt16 stripe;   // index of this file in the stripe set
+    epicsUInt16 nstripes;
+    epicsUInt16 reserved;
+    epicsUInt32 seqhi, seqlo; // chunk number within the stripe set
+    FileChunkHeader(unsigned stripe, unsigned nstripes, epicsUInt64 seq)
+        :P('P'), C('C')
+        ,stripe(htons(stripe))
+        ,nstripes(htons(nstripes))
+        ,reserved(0u)
+        ,seqhi(htonl(epicsUInt32(seq>>32u)))
+        ,seqlo(htonl(epicsUInt32(seq)))
+    {}
+};
+
+// .idx sidecar index entry.  See documentation/udpfast.rst
+struct FileIndexEntry {
+    char P, I;
+    epicsUInt16 msgid;
+    epicsUInt32 sec;
+    epicsUInt32 nsec;
+    epicsUInt32 offsethi, offsetlo; // data file offset of record (or .datz frame)
+    FileIndexEntry() :P('P'), I('I') {}
+};
+
+struct DataFD {
+    int fd;
+
+    DataFD() :fd(-1) {}
+    ~DataFD() { close(); }
+    void close() {
+        if(fd>=0)
+            ::close(fd);
+        fd = -1;
+    }
+    bool isOpen() const { return fd>=0; }
+    int release() {
+        int ret = fd;
+        fd = -1;
+        return ret;
+    }
+
+private:
+    DataFD(const DataFD&);
+    DataFD& operator=(const DataFD&);
+};
+
+struct PTimer {
+    const std::string name;
+    epicsUInt64 worst;
+    epicsUInt64 tstart;
+    explicit PTimer(const std::string& name) : name(name), worst(0.0), tstart(0u) {}
+    void start() {
+        tstart = epicsMonotonicGet();
+    }
+    void stop() {
+        epicsUInt64 tend = epicsMonotonicGet();
+        epicsUInt64 delta = tend-tstart; // ns
+        if(delta > worst) {
+            worst = delta;
+            if(PSCDebug>0)
+            errlogPrintf("PTimer %s max %.3f ms\n", name.c_str(), double(delta/1.0e6)); // ns -> ms
+        }
+    }
+};
+
+// Sidecar index of (time, file offset, msgid) for one data file.
+// An entry is added for the first record, then after every 'everyPkts' records
+// or 'everySec' seconds, whichever comes first.
+struct FileIndex {
+    epicsUInt32 everyPkts; // zero to disable
+    double everySec;       // zero to disable
+
+    // 'name' of the UDPFast instance, for messages
+    explicit FileIndex(const std::string& name);
+    ~FileIndex();
+
+    bool enabled() const { return everyPkts || everySec>0.0; }
+    bool isOpen() const { return fd.isOpen(); }
+
+    // create a new index file.  Returns zero or an errno
+    int open(const std::string& fname);
+    // write pending entries and close
+    void close();
+
+    // record 'pkt' is written at data file 'offset'.  Adds an entry if due
+    inline void note(const UDPFast::pkt& pkt, epicsUInt64 offset) {
+        if(!fd.isOpen())
+            return;
+        if(written) {
+            npkts++;
+            bool due = everyPkts && npkts>=everyPkts;
+            due |= everySec>0.0 && epicsTimeDiffInSeconds(&pkt.rxtime, &last)>=everySec;
+            if(!due)
+                return;
+        }
+        add(pkt, offset);
+    }
+    // unconditionally add an entry
+    void add(const UDPFast::pkt& pkt, epicsUInt64 offset);
+    // write out pending entries.  On error, the index file is closed
+    int flush();
+
+private:
+    const std::string name;
+    std::string fname;
+    DataFD fd;
+    std::vector<FileIndexEntry> entries; // not yet written
+    epicsUInt32 npkts; // since last entry
+    epicsTimeStamp last; // time of last entry
+    bool written; // any entry added to this file
+
+    FileIndex(const FileIndex&);
+    FileIndex& operator=(const FileIndex&);
+};
+
+// Moves batches of packets into an open data file.
+//
+// A writer may take ownership of packet buffers from submit()'d packets,
+// leaving an empty body behind.  Such buffers are handed back through
+// reap() once the OS is done with them.
+struct DataWriter {
+    typedef UDPFast::pkts_t pkts_t;
+
+    const std::string name; // for log messages
+    int fd;                 // not owned
+    epicsUInt64 offset;     // file position of next write
+    FileIndex *index;       // optional, not owned.  Told of each record as it is placed
+
+    DataWriter(const std::string& name);
+    virtual ~DataWriter();
+
+    // Extra flags for ::open() of data files
+    virtual int openFlags() const { return 0; }
+    // data file name suffix
+    virtual const char* extension() const { return ".dat"; }
+    // Begin writing to a newly opened (empty) file.
+    // Previous writes must already be reap()'d.
+    virtual void open(int fd);
+    // Write out anything buffered before the file is closed.
+    // Previous writes must already be reap()'d.
+    virtual int finish() { return 0; }
+
+    // Queue all packets for writing.
+    // Returns zero, or an errno after which the file should be abandoned.
+    virtual int submit(pkts_t& pkts) =0;
+    // Queue a chunk header, to be followed by a submit() beginning with 'first'
+    virtual int mark(const FileChunkHeader& chunk, const UDPFast::pkt& first) =0;
+    // Queue a data sync which completes after all previous submit()s.
+    virtual int sync() =0;
+    // Append packets whose buffers are no longer needed to 'done'.
+    // When 'wait' is set, blocks until all previous submit() and sync() complete.
+    virtual int reap(pkts_t& done, bool wait) =0;
+    // Any submit() or sync() not yet reap()'d
+    virtual bool busy() const =0;
+    // All data before this file offset has been written.  <= offset
+    virtual epicsUInt64 completed() const { return offset; }
+
+    struct Config {
+        // max. iovec per write
+        size_t iovLimit;
+        // >0 selects io_uring with this many writes in flight, if available
+        unsigned uringDepth;
+        // >0 selects O_DIRECT through a staging buffer of this many bytes
+        size_t directBuf;
+        // >0 selects zstd compression at this level, if available
+        int compressLevel;
+        // number of compression worker threads
+        unsigned compressThreads;
+        // if set, accumulate bytes into and out of compression
+        size_t *compressIn, *compressOut;
+        Config() :iovLimit(16u), uringDepth(0u), directBuf(0u)
+          ,compressLevel(0), compressThreads(1u), compressIn(0), compressOut(0) {}
+    };
+
+    // Default is synchronous writev()
+    static DataWriter* create(const std::string& name, const Config& conf);
+
+private:
+    DataWriter(const DataWriter&);
+    DataWriter& operator=(const DataWriter&);
+};
+
+// Bound the dirty page cache of a data file.
+// Writeback of each completed chunk is started without waiting.
+// Then writeback of the previous chunk is waited for, and it is dropped from the page cache.
+struct WritebackPacer {
+    epicsUInt64 chunk;   // bytes.  zero to disable
+    epicsUInt64 started; // writeback started before this file offset
+    epicsUInt64 dropped; // writeback complete, and dropped, before this file offset
+
+    WritebackPacer() :chunk(0u), started(0u), dropped(0u) {}
+
+    void open() { started = dropped = 0u; }
+    // file has been written up to 'offset'.  Returns zero or an errno
+    int update(int fd, epicsUInt64 offset);
+    // start writeback of any partial chunk before close()
+    int finish(int fd, epicsUInt64 offset);
+};
+
+// One stripe of a striped recording.  See documentation/udpfast.rst
+// Packets queue()'d by the cache worker are written by a dedicated thread
+// to files in one directory.  Packet buffers are handed back through reap().
+struct StripeWriter : public epicsThreadRunable
+{
+    typedef UDPFast::pkts_t pkts_t;
+
+    struct Config {
+        DataWriter::Config writer;
+        epicsUInt32 indexPkts;
+        double indexSec;
+        epicsUInt64 paceChunk; // bytes.  See WritebackPacer
+        epicsUInt64 syncSize;  // bytes between fdatasync().  zero to disable
+        size_t *wrote;         // if set, accumulate bytes written
+        Config() :indexPkts(0u), indexSec(0.0), paceChunk(0u), syncSize(0u), wrote(0) {}
+    };
+
+    const unsigned stripe, nstripes;
+
+    StripeWriter(const std::string& name, unsigned stripe, unsigned nstripes, const Config& conf);
+    virtual ~StripeWriter();
+
+    // data file name suffix
+    const char* extension() const { return writer->extension(); }
+
+    // Close any current file, then create and begin writing 'fname'
+    void open(const std::string& fname);
+    // Queue packets [begin, end) of 'pkts', taking their buffers.
+    // If 'start', then these begin chunk number 'seq'.
+    void queue(pkts_t& pkts, size_t begin, size_t end, bool start, epicsUInt64 seq);
+    // Close current file after all queued packets are written
+    void close();
+    // Wait until all queued operations are complete
+    void drain();
+    // Append packets whose buffers are no longer needed to 'done'.
+    // Returns zero, or the first error since the last reap(), after which the stripe set should be closed.
+    int reap(pkts_t& done);
+    // Any queued operation, or buffers, not yet reap()'d
+    bool busy() const;
+
+    virtual void run() override final;
+
+private:
+    const std::string name;
+    const Config conf;
+
+    struct Cmd {
+        enum kind_t {Open, Data, Close} kind;
+        std::string fname;
+        bool start;
+        epicsUInt64 seq;
+        pkts_t pkts;
+        Cmd() :kind(Data), start(false), seq(0u) {}
+    };
+
+    // only accessed by worker
+    DataWriter *writer;
+    DataFD datafile;
+    FileIndex index;
+    WritebackPacer pacer;
+    std::string fname;
+    epicsUInt64 accounted; // writer->offset already added to conf.wrote
+    epicsUInt64 unsynced;
+    int fileerr; // data is discarded until the next Open
+
+    mutable epicsMutex lock;
+    epicsEvent wakeup, drained;
+    // guarded by lock
+    std::deque<Cmd*> cmds;
+    std::vector<Cmd*> spare;
+    pkts_t reaped;
+    int error;
+    bool running;
+    bool active; // worker is executing a Cmd
+
+    epicsThread worker;
+
+    Cmd* alloc(Cmd::kind_t kind);
+    void push(Cmd *cmd);
+    void execute(Cmd& cmd, pkts_t& done);
+    void account();
+    void finish(pkts_t& done);
+    void fail(int err);
+
+    StripeWriter(const StripeWriter&);
+    StripeWriter& operator=(const StripeWriter&);
+};
+
+// Helper thread to move data file creation, preallocation, and closing
+// off of the capture path.
+// Spare files are created under a temporary name, and renamed when taken into use.
+struct FileRotator : public epicsThreadRunable
+{
+    explicit FileRotator(const std::string& name);
+    virtual ~FileRotator();
+
+    // Request that a spare file be made ready.
+    // 'prefix' is directory and base name.  Spare is preallocated to 'size' bytes
+    void prepare(const std::string& prefix, int flags, epicsUInt64 size);
+    // Take the ready spare file matching 'prefix' and 'flags'.
+    // Returns -1 if none is available.
+    int take(const std::string& prefix, int flags, std::string& tmpname);
+    // Rename a taken spare file.  Will not overwrite an existing file.
+    void rename(const std::string& from, const std::string& to);
+    // Truncate to 'size' and close()
+    void retire(int fd, epicsUInt64 size);
+
+    // Message from last failed operation, cleared on read
+    std::string lastError();
+    // If the last rename() failed, the name which the file still has, and the intended name.
+    // Cleared on read.
+    bool failedRename(std::string& from, std::string& to);
+
+    virtual void run() override final;
+
+private:
+    const std::string name;
+
+    struct Job {
+        enum kind_t {Prepare, Rename, Retire} kind;
+        std::string a, b;
+        int fd;
+        int flags;
+        epicsUInt64 size;
+    };
+
+    epicsMutex lock;
+    epicsEvent wakeup;
+    // guarded by lock
+    std::deque<Job> jobs;
+    bool running;
+    int sparefd;
+    std::string sparename, spareprefix;
+    int spareflags;
+    std::string error;
+    std::string failedFrom, failedTo;
+    unsigned seq;
+
+    epicsThread worker;
+
+    void queue(const Job& job);
+    void discardSpare();
+    void setError(const std::string& msg);
+
+    FileRotator(const FileRotator&);
+    FileRotator& operator=(const FileRotator&);
+};
+
+#endif // UDPWRITER_H